@@ -13,11 +13,18 @@
 
 #include <gitconddb_export.h>
 
+#include <array>
 #include <chrono>
+#include <cstdint>
 #include <functional>
+#include <future>
 #include <limits>
 #include <memory>
+#include <optional>
+#include <set>
+#include <string>
 #include <string_view>
+#include <tuple>
 #include <utility>
 #include <vector>
 
@@ -25,13 +32,52 @@ namespace GitCondDB {
   inline namespace v1 {
     namespace details {
       struct DBImpl;
-    }
+      class PayloadCache;
+      class TaskPool;
+      class Watcher;
+      class IOVBoundariesCache;
+      struct IOVBoundaries;
+      struct IOVTree;
+    } // namespace details
 
     struct CondDB;
     struct Logger;
 
     GITCONDDB_EXPORT CondDB connect( std::string_view repository, std::shared_ptr<Logger> logger = nullptr );
 
+    /// Tuning of libgit2 for the Git backend (see connect()).
+    ///
+    /// These settings are global in libgit2: they apply to all the Git repositories used by the
+    /// process (and stay in effect after the connection is closed). Unset fields leave the current
+    /// value unchanged.
+    struct GitOptions {
+      /// Maximum total size in bytes of the objects kept in the object cache (libgit2 default: 256 MiB).
+      std::optional<std::size_t> object_cache_size;
+      /// Maximum size in bytes of the blobs that may be kept in the object cache (libgit2 default: 0,
+      /// i.e. payloads are never cached and are read from the object database at each access).
+      std::optional<std::size_t> object_cache_blob_limit;
+      /// Size in bytes of the windows used to map pack files (libgit2 default: 1 GiB on 64 bits).
+      std::optional<std::size_t> mwindow_size;
+      /// Maximum total size in bytes of the mapped pack file windows (libgit2 default: 8 GiB on 64 bits).
+      std::optional<std::size_t> mwindow_mapped_limit;
+      /// Maximum number of pack files kept open at the same time (libgit2 default: 0, i.e. unlimited).
+      std::optional<std::size_t> open_packfiles;
+    };
+
+    /// Connect to a repository, with tuning of libgit2 (ignored for other backends).
+    GITCONDDB_EXPORT CondDB connect( std::string_view repository, const GitOptions& options,
+                                     std::shared_ptr<Logger> logger = nullptr );
+
+    /// Keep up to max_per_repository Git repository handles open after the disconnection of a CondDB
+    /// instance, for reuse (with their caches) by later connections to the same repository.
+    ///
+    /// Idle handles keep their pack files open and mapped, so none are kept by default and 0 restores
+    /// this behaviour, closing the handles kept so far.
+    GITCONDDB_EXPORT void keep_idle_repositories( std::size_t max_per_repository = 8 );
+
+    /// Close the Git repository handles kept open for reuse after the disconnection of a CondDB instance.
+    GITCONDDB_EXPORT void close_idle_repositories();
+
     /// Interface for customizable logger
     struct Logger {
       enum class Level { Debug, Verbose, Quiet, Nothing } level = Level::Quiet;
@@ -43,6 +89,12 @@ namespace GitCondDB {
       virtual ~Logger() = default;
     };
 
+    /// Access to a conditions database.
+    ///
+    /// Read access (the const methods) is thread-safe: it is possible to call get() or
+    /// iov_boundaries() on the same instance from several threads at the same time,
+    /// as long as the configuration methods (set_*, enable_*, ...) are not called
+    /// at the same time.
     struct GITCONDDB_EXPORT CondDB {
       using time_point_t = std::uint_fast64_t;
 
@@ -72,6 +124,37 @@ namespace GitCondDB {
         bool overlaps( const IOV& other ) const { return other.intersect( *this ).valid(); }
       };
 
+      /// Reference counted handle to the data of a payload.
+      ///
+      /// The data is not copied out of the backend storage (Git object, memory mapped file, ...):
+      /// the view returned by data() is valid as long as the handle, or a copy of it, exists.
+      class Payload {
+      public:
+        Payload() = default;
+        /// Wrap a string (the handle takes ownership of the data).
+        explicit Payload( std::string data ) {
+          auto storage = std::make_shared<const std::string>( std::move( data ) );
+          m_data       = *storage;
+          m_owner      = std::move( storage );
+        }
+        /// Reference data kept alive by owner.
+        Payload( std::shared_ptr<const void> owner, std::string_view data )
+            : m_owner{std::move( owner )}, m_data{data} {}
+
+        std::string_view data() const { return m_data; }
+        std::size_t      size() const { return m_data.size(); }
+        bool             empty() const { return m_data.empty(); }
+
+        /// Copy of the data.
+        std::string str() const { return std::string{m_data}; }
+
+        operator std::string_view() const { return m_data; }
+
+      private:
+        std::shared_ptr<const void> m_owner;
+        std::string_view            m_data;
+      };
+
       /// RAII object to limit the time the connection to the repository stay open.
       /// The lifetime of the CondDB object must be longer than the AccessGuard.
       class AccessGuard {
@@ -86,6 +169,33 @@ namespace GitCondDB {
 
       void disconnect() const;
 
+      /// Make sure that the following accesses see the current content of the repository.
+      ///
+      /// Tags are resolved only once (the first time they are used) and the payload cache
+      /// is not aware of changes in the repository, so, if tags are moved in the repository
+      /// while it is in use, refresh() (or update()) must be called to see the changes.
+      void refresh() const;
+
+      /// Bring the view of the repository up to date with the tags that moved since they were
+      /// first used, dropping from the payload cache only the entries that depend on the paths that
+      /// changed, and return the ids ("tag:path") of the changed entries (an empty list if nothing
+      /// changed).
+      ///
+      /// Contrary to refresh(), the payloads that did not change stay cached. Only the Git backend
+      /// can change (for the others this is a no-op).
+      std::vector<std::string> update() const;
+
+      /// Watch the repository for changes of the references, calling update() (from a background
+      /// thread) when they are modified and then callback with the list of changed entries, if
+      /// any (errors are reported as warnings).
+      ///
+      /// Only available on Linux and for the Git backend (std::runtime_error is thrown otherwise).
+      /// The CondDB instance must not be moved while it is watched.
+      void watch( std::function<void( const std::vector<std::string>& )> callback );
+      /// Stop watching the repository (no-op if not watching).
+      void stop_watching();
+      bool watching() const { return bool( m_watcher ); }
+
       bool connected() const;
 
       AccessGuard scoped_connection() const { return AccessGuard( *this ); }
@@ -95,13 +205,127 @@ namespace GitCondDB {
 
       std::tuple<std::string, IOV> get( const Key& key, const IOV& bounds ) const;
 
+      /// Same as get(), but without copying the payload data.
+      std::tuple<Payload, IOV> get_payload( const Key& key ) const { return get_payload( key, {} ); }
+
+      std::tuple<Payload, IOV> get_payload( const Key& key, const IOV& bounds ) const;
+
+      /// Retrieve the payloads for several keys in one go.
+      ///
+      /// Each tag is resolved only once and identical keys are looked up only once.
+      /// The lookups can be distributed over n_threads threads.
+      /// The results are in the same order as the keys.
+      std::vector<std::tuple<std::string, IOV>> get_many( const std::vector<Key>& keys,
+                                                          std::size_t             n_threads = 1 ) const {
+        return get_many( keys, {}, n_threads );
+      }
+      std::vector<std::tuple<std::string, IOV>> get_many( const std::vector<Key>& keys, const IOV& bounds,
+                                                          std::size_t n_threads = 1 ) const;
+
+      /// Payloads of one path in several tags (see get_in_tags()).
+      struct tags_payloads {
+        /// Distinct payloads, in order of first use.
+        struct group {
+          /// Identifier of the content (the blob id in the Git backend), empty if the payload
+          /// could not be identified (in which case the group has only one tag).
+          std::string content_id;
+          Payload     payload;
+          /// Indexes of the tags (in the requested list) resolving to this payload.
+          std::vector<std::size_t> tags;
+        };
+        std::vector<group> groups;
+        /// For each requested tag, the index of its group and the IOV of its payload.
+        std::vector<std::size_t> group_of;
+        std::vector<IOV>         iovs;
+      };
+
+      /// Resolve path at time_point in each of the tags, grouping the tags by the content of the
+      /// payload they resolve to (found without reading it), and reading each distinct payload only once.
+      ///
+      /// Tags can be resolved by n_threads threads.
+      tags_payloads get_in_tags( const std::vector<std::string>& tags, std::string_view path, time_point_t time_point,
+                                 std::size_t n_threads = 1 ) const;
+
+      /// Asynchronous version of get(), executed by the pool of worker threads of the instance.
+      ///
+      /// The instance must not be destroyed or moved while there are pending requests.
+      std::future<std::tuple<std::string, IOV>> get_async( const Key& key ) const { return get_async( key, {} ); }
+      std::future<std::tuple<std::string, IOV>> get_async( const Key& key, const IOV& bounds ) const;
+
+      /// Resolve, in the background, the payloads for some paths at a given time point, so
+      /// that the following calls to get() for them are served from memory.
+      ///
+      /// The lookups warm all the internal caches (tags, trees, IOVs), including the
+      /// payload cache if it is enabled. The returned future is ready when all lookups
+      /// are done, and reports the first error, if any.
+      std::future<void> prefetch( std::string_view tag, const std::vector<std::string>& paths,
+                                  time_point_t time_point ) const;
+
+      /// Number of threads used for the asynchronous requests (2 by default).
+      /// Pending requests are completed before changing it.
+      void        set_async_threads( std::size_t n_threads );
+      std::size_t async_threads() const;
+
       std::chrono::system_clock::time_point commit_time( const std::string& commit_id ) const;
 
       std::vector<time_point_t> iov_boundaries( std::string_view tag, std::string_view path ) const {
         return iov_boundaries( tag, path, {} );
       }
-      std::vector<time_point_t> iov_boundaries( std::string_view tag, std::string_view path,
-                                                const IOV& boundaries ) const;
+      /// Beginning of the IOVs of the payloads of path (within boundaries), going through the nested IOVs files.
+      ///
+      /// The entries of the tree of IOVs files can be looked up by n_threads threads, at most one per
+      /// hardware thread (the result does not depend on it).
+      std::vector<time_point_t> iov_boundaries( std::string_view tag, std::string_view path, const IOV& boundaries,
+                                                std::size_t n_threads = 1 ) const;
+
+      /// Interval of validity of one of the payloads of a condition (see iov_timeline()).
+      struct timeline_entry {
+        IOV iov;
+        /// Id of the object providing the payload ("tag:path").
+        std::string object_id;
+        /// Identifier of the content of the object (the blob id in the Git backend, the object id
+        /// otherwise), the same for identical payloads.
+        std::string content_id;
+        /// Content of the object, if requested (identical payloads share the data).
+        Payload payload;
+      };
+
+      /// Resolve in one traversal of the nested IOVs files all the payloads of path valid within
+      /// bounds, in the same order and with the same boundaries as iov_boundaries() (contiguous
+      /// entries can point to the same object).
+      ///
+      /// If with_payloads is true, the content of each distinct object is read once and shared by
+      /// all the entries using it.
+      std::vector<timeline_entry> iov_timeline( std::string_view tag, std::string_view path ) const {
+        return iov_timeline( tag, path, {} );
+      }
+      std::vector<timeline_entry> iov_timeline( std::string_view tag, std::string_view path, const IOV& bounds,
+                                                bool with_payloads = false ) const;
+
+      /// Paths of the conditions (files, or directories with an IOVs file) within prefix whose payloads or
+      /// IOVs differ between two tags, in alphabetical order.
+      ///
+      /// Only the entries that differ between the trees of the two tags are looked at (identical
+      /// subdirectories are skipped), and a condition is reported only if its timeline (see iov_timeline())
+      /// changed. Changes outside of the directory of a condition are not seen, even if its IOVs files refer
+      /// to them. If prefix is inside a condition, the condition is reported.
+      std::vector<std::string> changed_paths( std::string_view old_tag, std::string_view new_tag,
+                                              std::string_view prefix = {} ) const;
+
+      /// Write the whole content of a tag to a snapshot file, a compact binary image that can be
+      /// accessed with connect( "snapshot:<path>" ) without any parsing (see also the
+      /// gitconddb-snapshot command line tool).
+      ///
+      /// Identical payloads are stored only once and IOVs files are stored pre-parsed.
+      void export_snapshot( std::string_view tag, const std::string& path ) const {
+        export_snapshot( tag, path, {} );
+      }
+      /// Write to a snapshot file only the part of a tag needed to answer the requests for time
+      /// points within range.
+      ///
+      /// Conditions not valid in the range are dropped and IOVs files are trimmed to the entries
+      /// overlapping it, so requests outside the range may fail or give a different result.
+      void export_snapshot( std::string_view tag, const std::string& path, const IOV& range ) const;
 
       CondDB( CondDB&& );
       ~CondDB();
@@ -121,13 +345,113 @@ namespace GitCondDB {
       Logger* logger() const;
 
       bool iov_reduction() const { return m_reduce_iovs; }
-      void set_iov_reduction( bool value ) { m_reduce_iovs = value; }
+      void set_iov_reduction( bool value );
+
+      /// Statistics of the payload cache.
+      struct cache_stats {
+        std::size_t hits      = 0;
+        std::size_t misses    = 0;
+        std::size_t evictions = 0;
+        std::size_t entries   = 0;
+        std::size_t bytes     = 0;
+      };
+
+      /// Enable caching of the payloads returned by get(), so that repeated requests for a time point
+      /// within an already resolved IOV do not need to access the repository.
+      /// The cache keeps at most max_entries payloads, for a total of at most max_bytes, evicting
+      /// the least recently used entries first.
+      void enable_payload_cache( std::size_t max_entries, std::size_t max_bytes );
+      void disable_payload_cache();
+      bool payload_cache_enabled() const { return bool( m_payload_cache ); }
+      /// Drop all cached payloads (e.g. if a tag has been moved in the repository).
+      void        clear_payload_cache() const;
+      cache_stats payload_cache_stats() const;
+
+      /// Statistics of the sharing of identical payloads (only the Git backend shares them, by blob id).
+      struct dedup_stats {
+        /// Number of payloads requested.
+        std::size_t lookups = 0;
+        /// Number of requests served with a payload already in use (not read again).
+        std::size_t hits = 0;
+        /// Total size of the payloads served without reading them again.
+        std::size_t bytes_saved = 0;
+        /// Distinct payloads currently in use (by the caller or by the payload cache).
+        std::size_t payloads = 0;
+        /// Total size of the distinct payloads currently in use.
+        std::size_t bytes = 0;
+      };
+      dedup_stats payload_dedup_stats() const;
+
+      /// Operations of the backend instrumented by the metrics.
+      enum class operation { get, exists, iov_parse, revparse, blob_read, dir_conversion };
+      static constexpr std::size_t n_operations = 6;
+      static std::string_view      operation_name( operation op );
+
+      /// Number of calls and latency of an operation.
+      struct operation_stats {
+        /// Bin i of the latency histogram counts the calls that took between 2^i and 2^(i+1) ns
+        /// (the last bin counts also all the longer calls).
+        static constexpr std::size_t n_bins = 32;
+
+        std::uint64_t                     count    = 0;
+        std::uint64_t                     total_ns = 0;
+        std::uint64_t                     max_ns   = 0;
+        std::array<std::uint64_t, n_bins> latency_histogram{};
+      };
+
+      /// Snapshot of the metrics of the backend ("git", "filesystem" or "json").
+      struct metrics_stats {
+        std::string                               backend;
+        std::array<operation_stats, n_operations> operations{};
+
+        const operation_stats& operator[]( operation op ) const {
+          return operations[static_cast<std::size_t>( op )];
+        }
+      };
+
+      /// Enable recording of the metrics (disabled by default).
+      /// Recording is lock-free and, when disabled, it costs only the check of a flag.
+      void          enable_metrics( bool value = true );
+      bool          metrics_enabled() const;
+      metrics_stats metrics() const;
+      void          reset_metrics() const;
 
     private:
       CondDB( std::unique_ptr<details::DBImpl> impl );
 
-      void iov_boundaries_accumulate( const std::string& object_id, const IOV& limits,
-                                      std::vector<std::pair<IOV, std::string>>& acc ) const;
+      /// How a payload was found, to know if and how it can be cached.
+      enum class resolution { blob, iov_blob, directory };
+
+      /// Implementation of get, using lookup_key to access the database and key for the payload cache.
+      std::tuple<Payload, IOV> get( const Key& key, const Key& lookup_key, const IOV& bounds ) const;
+
+      /// Find the payload for key within bounds.
+      ///
+      /// If scope is not null, it is narrowed to the closest common directory of the entries
+      /// used for the resolution (it should initially be the normalized path of the key).
+      std::tuple<Payload, IOV> resolve( const Key& key, const IOV& bounds, resolution& how,
+                                        std::string* scope = nullptr ) const;
+
+      /// Flattened IOVs of an object (cached by content id), narrowing scope to the closest common
+      /// directory of the entries used (see resolve()).
+      ///
+      /// If tree is not null, the data of the entries is taken from it instead of the backend.
+      std::shared_ptr<const details::IOVBoundaries> flat_iovs( const std::string& object_id, std::string& scope,
+                                                               const details::IOVTree* tree = nullptr ) const;
+
+      /// Id of the object providing the payload for key within bounds, and its IOV, following the IOVs
+      /// files without reading the payload (the id is empty if there is no payload for the time point).
+      std::tuple<std::string, IOV> locate( const Key& key, const IOV& bounds ) const;
+
+      /// Add to out the conditions in the entry with the given id (the entry itself if it is a condition).
+      void collect_conditions( const std::string& object_id, std::set<std::string>& out ) const;
+
+      /// Append to acc the entries of the timeline of object_id within limits.
+      void iov_timeline_accumulate( const std::string& object_id, const IOV& limits,
+                                    std::vector<timeline_entry>& acc ) const;
+
+      /// Collect the data needed by flat_iovs for object_id and all its nested IOVs, using n_threads threads.
+      details::IOVTree collect_iov_tree( const std::string& object_id, std::size_t n_threads ) const;
 
       std::unique_ptr<details::DBImpl> m_impl;
 
@@ -136,7 +460,20 @@ namespace GitCondDB {
       /// If true, hide IOV boundaries if the payload does not change.
       bool m_reduce_iovs = true;
 
+      std::unique_ptr<details::PayloadCache> m_payload_cache;
+
+      /// Results of iov_boundaries() for the entries already visited.
+      std::unique_ptr<details::IOVBoundariesCache> m_boundaries_cache;
+
+      /// Workers for asynchronous requests.
+      std::unique_ptr<details::TaskPool> m_workers;
+
+      /// Thread calling update() when the repository changes (last, so that it is destroyed first).
+      std::unique_ptr<details::Watcher> m_watcher;
+
       friend GITCONDDB_EXPORT CondDB connect( std::string_view repository, std::shared_ptr<Logger> logger );
+      friend GITCONDDB_EXPORT CondDB connect( std::string_view repository, const GitOptions& options,
+                                              std::shared_ptr<Logger> logger );
     };
   } // namespace v1
 } // namespace GitCondDB
@@ -21,15 +21,33 @@ namespace fs = std::filesystem;
 namespace fs = std::experimental::filesystem;
 #endif
 
+#include "JSONTree.h"
+#include "Metrics.h"
+#include "PayloadStore.h"
+#include "Watcher.h"
 #include "git_helpers.h"
+#include "iov_helpers.h"
+#include "snapshot_format.h"
 
 #include "common.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <ctime>
 #include <fstream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
 #include <variant>
+#include <vector>
 
 #include <fmt/core.h>
-#include <nlohmann/json.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace GitCondDB {
   inline namespace v1 {
@@ -49,9 +67,46 @@ namespace GitCondDB {
         void debug( std::string_view ) const override {}
       };
 
+      /// Read-only memory mapping of a file, unmapped on destruction.
+      struct mapped_file {
+        void*       addr = nullptr;
+        std::size_t size = 0;
+
+        ~mapped_file() {
+          if ( addr ) munmap( addr, size );
+        }
+
+        std::string_view data() const { return {static_cast<const char*>( addr ), size}; }
+
+        /// Map the content of a file (empty files are not mapped).
+        static std::shared_ptr<const mapped_file> open( const fs::path& path ) {
+          const int fd = ::open( path.c_str(), O_RDONLY );
+          if ( UNLIKELY( fd < 0 ) ) throw std::runtime_error{"cannot open file " + path.string()};
+          struct stat st;
+          auto        mapping = ( fstat( fd, &st ) == 0 ) ? map( fd, static_cast<std::size_t>( st.st_size ) ) : nullptr;
+          ::close( fd );
+          if ( UNLIKELY( !mapping ) ) throw std::runtime_error{"cannot map file " + path.string()};
+          return mapping;
+        }
+
+        /// Map size bytes of an open file, returning nullptr in case of failure.
+        static std::shared_ptr<const mapped_file> map( int fd, std::size_t size ) {
+          auto mapping = std::make_shared<mapped_file>();
+          if ( size ) {
+            mapping->addr = mmap( nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+            if ( UNLIKELY( mapping->addr == MAP_FAILED ) ) return nullptr;
+            mapping->size = size;
+          }
+          return mapping;
+        }
+      };
+
       class DBImpl {
       public:
         using dir_content = CondDB::dir_content;
+        using Payload     = CondDB::Payload;
+        using operation   = CondDB::operation;
+        using timer       = Metrics::timer;
 
         virtual ~DBImpl() = default;
 
@@ -59,12 +114,118 @@ namespace GitCondDB {
 
         virtual bool connected() const = 0;
 
+        /// Name of the backend, for the metrics.
+        virtual std::string_view backend_name() const = 0;
+
         virtual bool exists( const char* object_id ) const = 0;
 
-        virtual std::variant<std::string, dir_content> get( const char* object_id ) const = 0;
+        /// Return the content of a file (without copying it, if possible) or of a directory.
+        virtual std::variant<Payload, dir_content> get_payload( const char* object_id ) const = 0;
+
+        std::variant<std::string, dir_content> get( const char* object_id ) const {
+          auto data = get_payload( object_id );
+          if ( data.index() == 1 ) return std::move( std::get<1>( data ) );
+          return std::get<0>( data ).str();
+        }
+
+        /// Return the parsed content of an IOVs file.
+        virtual std::shared_ptr<const Helpers::IOVIndex> get_iovs( const char* object_id ) const {
+          const auto data = std::get<0>( get_payload( object_id ) );
+          timer      t{metrics(), operation::iov_parse};
+          return std::make_shared<const Helpers::IOVIndex>( data.data() );
+        }
+
+        /// Directory as seen by CondDB.
+        struct directory {
+          /// Parsed IOVs file of the directory, if it has one (in which case content is not filled).
+          std::shared_ptr<const Helpers::IOVIndex> iovs;
+          /// Entries of the directory, with the subdirectories containing an IOVs file listed
+          /// among the files (they are conditions).
+          dir_content content;
+        };
+
+        /// Return the content of a file or the description of a directory.
+        ///
+        /// The default implementation is based on get_payload, exists and get_iovs, but backends
+        /// can do it with a single access to the directory.
+        virtual std::variant<Payload, directory> lookup( const char* object_id ) const {
+          auto data = get_payload( object_id );
+          if ( data.index() == 0 ) return std::move( std::get<0>( data ) );
+
+          directory  out;
+          auto&      content = std::get<1>( data );
+          const auto prefix  = child_prefix( object_id );
+          if ( std::find( begin( content.files ), end( content.files ), "IOVs" ) != end( content.files ) ) {
+            out.iovs = get_iovs( ( prefix + "IOVs" ).c_str() );
+            return out;
+          }
+          std::vector<std::string> dirs;
+          dirs.reserve( content.dirs.size() );
+          for ( auto& d : content.dirs ) {
+            ( exists( ( prefix + d + "/IOVs" ).c_str() ) ? content.files : dirs ).emplace_back( std::move( d ) );
+          }
+          content.dirs = std::move( dirs );
+          out.content  = std::move( content );
+          return out;
+        }
+
+        /// Return the parsed IOVs file in a directory, or nullptr if object_id is not a directory
+        /// containing an IOVs file.
+        virtual std::shared_ptr<const Helpers::IOVIndex> find_iovs( const char* object_id ) const {
+          const auto iovs_id = child_prefix( object_id ) + "IOVs";
+          return exists( iovs_id.c_str() ) ? get_iovs( iovs_id.c_str() ) : nullptr;
+        }
 
         virtual std::chrono::system_clock::time_point commit_time( const char* commit_id ) const = 0;
 
+        /// Return an identifier equivalent to tag that is cheaper to use in object ids
+        /// (by default the tag itself).
+        virtual std::string resolve_tag( const char* tag ) const { return tag; }
+
+        /// Drop the cached view of the database, if any, so that following accesses see the
+        /// current content.
+        virtual void refresh() const {}
+
+        /// Identifier of the content of an entry (and of everything it contains), used to cache
+        /// data derived from it: entries with the same content id are identical, until refresh().
+        ///
+        /// By default it is the object id itself. An empty string means that the entry does not
+        /// exist or that its content cannot be identified.
+        virtual std::string content_id( const char* object_id ) const { return object_id; }
+
+        /// Bring the cached view of the database up to date, returning the ids ("tag:path")
+        /// of the entries that changed since they were first accessed (a changed directory
+        /// means that all its content may have changed).
+        ///
+        /// By default there is nothing to update.
+        virtual std::vector<std::string> update() const { return {}; }
+
+        /// Directories whose modification may change the content of the database, to be
+        /// watched to trigger an update().
+        virtual std::vector<Watcher::directory> watch_paths() const { return {}; }
+
+        /// Statistics of the sharing of identical payloads (by default payloads are not shared).
+        virtual CondDB::dedup_stats dedup_stats() const { return {}; }
+
+        /// Paths (without tag) of the entries that differ between two versions of a directory (or a
+        /// file), given as object ids of the same path in two tags.
+        ///
+        /// Entries present in both versions are compared recursively (skipping the directories with the
+        /// same content id), so a directory is listed only if it is missing in one of the versions (or
+        /// it is a file in the other).
+        virtual std::vector<std::string> diff( const char* old_id, const char* new_id ) const {
+          std::vector<std::string> out;
+          diff_entries( old_id, new_id, out );
+          return out;
+        }
+
+        /// Prefix of the ids of the entries of a directory ("tag:dir/" or "tag:" for the root).
+        inline static std::string child_prefix( std::string_view object_id ) {
+          std::string prefix{object_id};
+          if ( !strip_tag( object_id ).empty() ) prefix += '/';
+          return prefix;
+        }
+
         inline static std::string_view strip_tag( std::string_view object_id ) {
           if ( const auto pos = object_id.find_first_of( ':' ); pos != object_id.npos ) {
             object_id.remove_prefix( pos + 1 );
@@ -83,68 +244,182 @@ namespace GitCondDB {
         }
         Logger* logger() const { return log.get(); }
 
+        Metrics& metrics() const { return m_metrics; }
+
         // logging helpers
         void debug( std::string_view msg ) const { log->debug( msg ); }
         void info( std::string_view msg ) const { log->info( msg ); }
         void warning( std::string_view msg ) const { log->warning( msg ); }
 
       private:
+        /// Generic implementation of diff(), based on exists, content_id and get_payload.
+        void diff_entries( const std::string& old_id, const std::string& new_id, std::vector<std::string>& out ) const {
+          const bool old_exists = exists( old_id.c_str() );
+          const bool new_exists = exists( new_id.c_str() );
+          if ( !old_exists && !new_exists ) return;
+          const std::string path{strip_tag( new_id )};
+          if ( old_exists != new_exists ) {
+            out.push_back( path );
+            return;
+          }
+          if ( const auto id = content_id( old_id.c_str() ); !id.empty() && id == content_id( new_id.c_str() ) ) return;
+
+          const auto old_data = get_payload( old_id.c_str() );
+          const auto new_data = get_payload( new_id.c_str() );
+          if ( old_data.index() != new_data.index() ) {
+            out.push_back( path );
+          } else if ( old_data.index() == 0 ) {
+            if ( std::get<0>( old_data ).data() != std::get<0>( new_data ).data() ) out.push_back( path );
+          } else {
+            std::vector<std::string> names;
+            for ( const auto* content : {&std::get<1>( old_data ), &std::get<1>( new_data )} ) {
+              names.insert( names.end(), content->dirs.begin(), content->dirs.end() );
+              names.insert( names.end(), content->files.begin(), content->files.end() );
+            }
+            std::sort( names.begin(), names.end() );
+            names.erase( std::unique( names.begin(), names.end() ), names.end() );
+            const auto old_prefix = child_prefix( old_id );
+            const auto new_prefix = child_prefix( new_id );
+            for ( const auto& name : names ) diff_entries( old_prefix + name, new_prefix + name, out );
+          }
+        }
+
         std::shared_ptr<Logger> log;
+
+        mutable Metrics m_metrics;
       };
 
+      /// Access to a Git repository.
+      ///
+      /// The implementation can be used concurrently from several threads: each
+      /// call gets exclusive use of a repository handle from a pool, so at most
+      /// one handle per concurrent thread is opened.
+      ///
+      /// Tags are resolved to the tree they point to the first time they are used,
+      /// and that tree is used for all the following accesses, until refresh() or
+      /// disconnect() are called, or update() sees that the tag moved.
       class GitImpl : public DBImpl {
-        using git_object_ptr     = GitCondDB::Helpers::git_object_ptr;
-        using git_repository_ptr = GitCondDB::Helpers::git_repository_ptr;
+        using git_object_ptr          = GitCondDB::Helpers::git_object_ptr;
+        using git_odb_ptr             = GitCondDB::Helpers::git_odb_ptr;
+        using git_odb_object_ptr      = GitCondDB::Helpers::git_odb_object_ptr;
+        using git_repository_pool     = GitCondDB::Helpers::git_repository_pool;
+        using git_repository_registry = GitCondDB::Helpers::git_repository_registry;
 
       public:
-        GitImpl( std::string_view repository, std::shared_ptr<Logger> logger = nullptr )
+        GitImpl( std::string_view repository, std::shared_ptr<Logger> logger = nullptr,
+                 const GitOptions& options = {} )
             : DBImpl{std::move( logger )}
             , m_repository_url( repository )
-            , m_repository{[this]() -> git_repository_ptr::storage_t {
-              info( fmt::format( "opening Git repository '{}'", m_repository_url ) );
-              auto res = git_call<git_repository_ptr::storage_t>( "cannot open repository", m_repository_url,
-                                                                  git_repository_open, m_repository_url.c_str() );
-              if ( UNLIKELY( !res ) ) throw std::runtime_error{"invalid Git repository: '" + m_repository_url + "'"};
-              return res;
-            }} {
-          // Initialize Git library
-          git_libgit2_init();
-
+            , m_registry{git_repository_registry::instance()}
+            , m_registry_key{fs::absolute( m_repository_url ).string()}
+            , m_repository{[this]() { return open_repository(); },
+                           [this]( git_repository_pool::slot s ) { release_repository( std::move( s ) ); }} {
+          // libgit2 is initialized by the registry, so it can be configured now
+          configure( options );
           // try access during construction
-          m_repository.get();
-        }
-
-        ~GitImpl() override {
-          // Finalize Git library
-          git_libgit2_shutdown();
+          m_repository.acquire();
         }
 
+        /// The repository handles are closed, unless the process-wide registry is set to keep them
+        /// for the following connections (see keep_idle_repositories()).
         void disconnect() const override {
           debug( "disconnect from Git repository" );
           m_repository.reset();
+          refresh();
         }
 
         bool connected() const override { return m_repository.is_set(); }
 
+        std::string_view backend_name() const override { return "git"; }
+
+        /// Forget the trees the tags were resolved to, so that they are resolved again.
+        void refresh() const override {
+          std::lock_guard<std::mutex> guard( m_tags_mutex );
+          m_tags.clear();
+          m_commit_trees.clear();
+        }
+
+        /// Resolve again the tags in use and, for those that moved, compare the old and new
+        /// trees to report the paths that changed (the other cached data is keyed by object id,
+        /// so it does not need to be invalidated).
+        std::vector<std::string> update() const override {
+          decltype( m_tags ) tags;
+          {
+            std::lock_guard<std::mutex> guard( m_tags_mutex );
+            tags = m_tags;
+          }
+          std::vector<std::string> changes;
+          auto                     repo = m_repository.acquire();
+          for ( const auto& [tag, old_id] : tags ) {
+            const auto new_id = peel_tree( repo, tag );
+            if ( new_id && git_oid_equal( &old_id, &*new_id ) ) continue;
+            if ( new_id ) {
+              info( fmt::format( "tag '{}' moved", tag ) );
+              diff_trees( repo, old_id, *new_id, tag + ':', changes );
+            } else {
+              warning( fmt::format( "tag '{}' cannot be resolved anymore", tag ) );
+              changes.push_back( tag + ':' );
+            }
+            std::lock_guard<std::mutex> guard( m_tags_mutex );
+            if ( new_id ) {
+              m_tags.insert_or_assign( tag, *new_id );
+            } else {
+              m_tags.erase( tag );
+            }
+          }
+          return changes;
+        }
+
+        /// The directories containing the references: the repository itself for packed-refs, and
+        /// the whole refs directory, for hierarchical names (e.g. "release/v1") and new kinds of refs.
+        std::vector<Watcher::directory> watch_paths() const override {
+          auto              repo = m_repository.acquire();
+          const std::string path = git_repository_path( repo );
+          return {{path, false}, {path + "refs", true}};
+        }
+
+        /// Entries with the same object id in both versions (in particular subtrees) are skipped
+        /// without looking into them.
+        std::vector<std::string> diff( const char* old_id, const char* new_id ) const override {
+          std::vector<std::string> out;
+          auto                     repo    = m_repository.acquire();
+          const auto               old_obj = find_object( repo, old_id );
+          const auto               new_obj = find_object( repo, new_id );
+          if ( !old_obj && !new_obj ) return out;
+          if ( old_obj && new_obj && git_oid_equal( &old_obj.id, &new_obj.id ) ) return out;
+          const std::string path{strip_tag( new_id )};
+          if ( old_obj.type == GIT_OBJ_TREE && new_obj.type == GIT_OBJ_TREE ) {
+            diff_trees( repo, old_obj.id, new_obj.id, path.empty() ? path : path + '/', out );
+          } else {
+            out.push_back( path );
+          }
+          return out;
+        }
+
+        /// Payloads are shared by blob id (see shared_object).
+        CondDB::dedup_stats dedup_stats() const override { return m_payloads.stats(); }
+
         bool exists( const char* object_id ) const override {
-          git_object* tmp = nullptr;
-          git_revparse_single( &tmp, m_repository.get(), object_id );
-          bool result = tmp;
-          git_object_free( tmp );
-          return result;
+          timer t{metrics(), operation::exists};
+          auto  repo = m_repository.acquire();
+          return bool( find_object( repo, object_id ) );
         }
 
-        std::variant<std::string, dir_content> get( const char* object_id ) const override {
+        /// File payloads are read directly from the object database and returned without copies.
+        std::variant<Payload, dir_content> get_payload( const char* object_id ) const override {
+          timer t{metrics(), operation::get};
           debug( std::string{"get Git object "} + object_id );
-          std::variant<std::string, dir_content> out;
-          auto                                   obj = get_object( object_id );
-          if ( git_object_type( obj.get() ) == GIT_OBJ_TREE ) {
+          std::variant<Payload, dir_content> out;
+          auto                               repo = m_repository.acquire();
+          const auto                         obj  = get_object( repo, object_id );
+          if ( obj.type == GIT_OBJ_TREE ) {
             debug( "found tree object" );
 
             dir_content entries;
             entries.root = strip_tag( object_id );
 
-            const git_tree* tree = reinterpret_cast<const git_tree*>( obj.get() );
+            const git_tree* tree = repo.trees().get( repo, &obj.id );
+            if ( UNLIKELY( !tree ) ) throw std::runtime_error{std::string{"cannot read tree "} + object_id};
 
             const std::size_t     max_i = git_tree_entrycount( tree );
             const git_tree_entry* te    = nullptr;
@@ -157,33 +432,351 @@ namespace GitCondDB {
             out = std::move( entries );
           } else {
             debug( "found blob object" );
+            out = shared_object( repo, obj.id, object_id );
+          }
+          return out;
+        }
+
+        /// Parsed IOVs files are cached by blob id, so that they are read and parsed only once.
+        std::shared_ptr<const Helpers::IOVIndex> get_iovs( const char* object_id ) const override {
+          debug( std::string{"get IOVs from Git object "} + object_id );
+          auto       repo = m_repository.acquire();
+          const auto obj  = get_object( repo, object_id );
+          if ( UNLIKELY( obj.type != GIT_OBJ_BLOB ) )
+            throw std::runtime_error{std::string{"invalid IOVs object "} + object_id};
+          return iovs_index( repo, obj.id, object_id );
+        }
+
+        /// The IOVs files and the subdirectories are looked up in the tree of the directory,
+        /// instead of walking again the path from the root tree for each of them.
+        std::variant<Payload, directory> lookup( const char* object_id ) const override {
+          timer t{metrics(), operation::get};
+          debug( std::string{"lookup Git object "} + object_id );
+          auto       repo = m_repository.acquire();
+          const auto obj  = get_object( repo, object_id );
+          if ( obj.type != GIT_OBJ_TREE ) {
+            debug( "found blob object" );
+            return shared_object( repo, obj.id, object_id );
+          }
+          debug( "found tree object" );
 
-            auto blob = reinterpret_cast<const git_blob*>( obj.get() );
-            out       = std::string{reinterpret_cast<const char*>( git_blob_rawcontent( blob ) ),
-                              static_cast<std::size_t>( git_blob_rawsize( blob ) )};
+          // keep our own reference to the tree, as the cache may drop it while we look up the subdirectories
+          const auto tree = tree_ref( repo, obj.id, object_id );
+
+          directory out;
+          if ( const auto te = git_tree_entry_byname( tree.get(), "IOVs" );
+               te && git_tree_entry_type( te ) == GIT_OBJ_BLOB ) {
+            out.iovs = iovs_index( repo, *git_tree_entry_id( te ), object_id );
+            return out;
+          }
+
+          out.content.root = strip_tag( object_id );
+
+          const std::size_t max_i = git_tree_entrycount( tree.get() );
+          for ( std::size_t i = 0; i < max_i; ++i ) {
+            const git_tree_entry* te   = git_tree_entry_byindex( tree.get(), i );
+            bool                  file = true;
+            if ( git_tree_entry_type( te ) == GIT_OBJ_TREE ) {
+              const git_tree* subtree = repo.trees().get( repo, git_tree_entry_id( te ) );
+              file                    = subtree && git_tree_entry_byname( subtree, "IOVs" );
+            }
+            ( file ? out.content.files : out.content.dirs ).emplace_back( git_tree_entry_name( te ) );
           }
           return out;
         }
 
+        std::shared_ptr<const Helpers::IOVIndex> find_iovs( const char* object_id ) const override {
+          debug( std::string{"look for IOVs in Git object "} + object_id );
+          auto       repo = m_repository.acquire();
+          const auto obj  = find_object( repo, object_id );
+          if ( obj.type != GIT_OBJ_TREE ) return nullptr;
+
+          const git_tree*       tree = repo.trees().get( repo, &obj.id );
+          const git_tree_entry* te   = tree ? git_tree_entry_byname( tree, "IOVs" ) : nullptr;
+          if ( !te ) return nullptr;
+          if ( UNLIKELY( git_tree_entry_type( te ) != GIT_OBJ_BLOB ) )
+            throw std::runtime_error{std::string{"invalid IOVs object "} + object_id + "/IOVs"};
+          return iovs_index( repo, *git_tree_entry_id( te ), object_id );
+        }
+
+        /// The id of the Git object, which does not depend on the tag or on the path.
+        std::string content_id( const char* object_id ) const override {
+          auto       repo = m_repository.acquire();
+          const auto obj  = find_object( repo, object_id );
+          if ( !obj ) return {};
+          char oid[GIT_OID_HEXSZ + 1];
+          return git_oid_tostr( oid, sizeof( oid ), &obj.id );
+        }
+
+        /// Return the id of the tree the tag points to, or the tag itself if it cannot be resolved.
+        std::string resolve_tag( const char* tag ) const override {
+          auto repo = m_repository.acquire();
+          if ( const auto tree_id = tag_tree( repo, tag ) ) {
+            char oid[GIT_OID_HEXSZ + 1];
+            return git_oid_tostr( oid, sizeof( oid ), &*tree_id );
+          }
+          return tag;
+        }
+
         std::chrono::system_clock::time_point commit_time( const char* commit_id ) const override {
-          auto obj = get_object( commit_id, "commit" );
-          return std::chrono::system_clock::from_time_t(
-              git_commit_time( reinterpret_cast<git_commit*>( obj.get() ) ) );
+          auto        repo   = m_repository.acquire();
+          const auto  obj    = get_object( repo, commit_id, "commit" );
+          git_commit* commit = nullptr;
+          if ( UNLIKELY( git_commit_lookup( &commit, repo, &obj.id ) ) )
+            throw std::runtime_error{std::string{"cannot resolve commit "} + commit_id + ": " + giterr_last()->message};
+          const auto t = git_commit_time( commit );
+          git_commit_free( commit );
+          return std::chrono::system_clock::from_time_t( t );
         }
 
       private:
-        git_object_ptr get_object( const char* commit_id, const std::string& obj_type = "object" ) const {
-          return git_call<git_object_ptr>( "cannot resolve " + obj_type, commit_id, git_revparse_single,
-                                           m_repository.get(), commit_id );
+        /// Type and id of an object in the repository.
+        struct object_ref {
+          git_object_t type = GIT_OBJECT_INVALID;
+          git_oid      id{};
+
+          explicit operator bool() const { return type != GIT_OBJECT_INVALID; }
+        };
+
+        /// Id of the tree the tag points to (resolved only once).
+        ///
+        /// Full object ids cannot move, so they are not tracked as tags: tree ids (e.g. from
+        /// resolve_tag) are used directly and the trees of commit ids are kept apart from the tags.
+        std::optional<git_oid> tag_tree( git_repository* repo, std::string_view tag ) const {
+          git_oid    id;
+          const bool full_id = tag.size() == GIT_OID_HEXSZ && git_oid_fromstrn( &id, tag.data(), tag.size() ) == 0;
+          if ( full_id ) {
+            git_tree* tree = nullptr;
+            if ( git_tree_lookup( &tree, repo, &id ) == 0 ) {
+              git_tree_free( tree );
+              return id;
+            }
+          }
+          auto& trees = full_id ? m_commit_trees : m_tags;
+          {
+            std::lock_guard<std::mutex> guard( m_tags_mutex );
+            if ( auto it = trees.find( tag ); it != trees.end() ) return it->second;
+          }
+          auto out = peel_tree( repo, tag );
+          if ( out ) {
+            std::lock_guard<std::mutex> guard( m_tags_mutex );
+            trees.emplace( tag, *out );
+          }
+          return out;
+        }
+
+        /// Id of the tree the tag currently points to.
+        std::optional<git_oid> peel_tree( git_repository* repo, std::string_view tag ) const {
+          timer       t{metrics(), operation::revparse};
+          git_object* obj  = nullptr;
+          git_object* tree = nullptr;
+
+          std::optional<git_oid> out;
+          if ( git_revparse_single( &obj, repo, std::string{tag}.c_str() ) == 0 &&
+               git_object_peel( &tree, obj, GIT_OBJ_TREE ) == 0 ) {
+            out = *git_object_id( tree );
+          }
+          git_object_free( tree );
+          git_object_free( obj );
+          return out;
+        }
+
+        /// Append to out the ids (prefix + path) of the entries that differ between two trees.
+        ///
+        /// Subtrees with different ids are compared recursively, so that only the entries
+        /// that actually changed are reported.
+        void diff_trees( git_repository* repo, const git_oid& old_id, const git_oid& new_id, const std::string& prefix,
+                         std::vector<std::string>& out ) const {
+          const auto old_tree = tree_ref( repo, old_id, prefix.c_str() );
+          const auto new_tree = tree_ref( repo, new_id, prefix.c_str() );
+
+          const std::size_t old_n = git_tree_entrycount( old_tree.get() );
+          for ( std::size_t i = 0; i < old_n; ++i ) {
+            const git_tree_entry* te    = git_tree_entry_byindex( old_tree.get(), i );
+            const char*           name  = git_tree_entry_name( te );
+            const git_tree_entry* other = git_tree_entry_byname( new_tree.get(), name );
+            if ( other && git_oid_equal( git_tree_entry_id( te ), git_tree_entry_id( other ) ) ) continue;
+            if ( other && git_tree_entry_type( te ) == GIT_OBJ_TREE && git_tree_entry_type( other ) == GIT_OBJ_TREE ) {
+              diff_trees( repo, *git_tree_entry_id( te ), *git_tree_entry_id( other ), prefix + name + '/', out );
+            } else {
+              out.push_back( prefix + name );
+            }
+          }
+          const std::size_t new_n = git_tree_entrycount( new_tree.get() );
+          for ( std::size_t i = 0; i < new_n; ++i ) {
+            const char* name = git_tree_entry_name( git_tree_entry_byindex( new_tree.get(), i ) );
+            if ( !git_tree_entry_byname( old_tree.get(), name ) ) out.push_back( prefix + name );
+          }
+        }
+
+        /// Look for an object in the repository, returning an invalid reference if it does not exist.
+        ///
+        /// Object ids in the form "tag:path" are looked up walking the path from the tree
+        /// of the tag, with the help of the cache of tree objects, anything else is
+        /// resolved with git_revparse_single.
+        /// Blobs are not loaded, so that checking for their existence is cheap.
+        object_ref find_object( git_repository_pool::handle& repo, std::string_view object_id ) const {
+          const auto pos = object_id.find_first_of( ':' );
+          if ( pos == object_id.npos ) {
+            git_object_ptr obj;
+            {
+              timer       t{metrics(), operation::revparse};
+              git_object* tmp = nullptr;
+              git_revparse_single( &tmp, repo, std::string{object_id}.c_str() );
+              obj.reset( tmp );
+            }
+            if ( !obj ) return {};
+            return {git_object_type( obj.get() ), *git_object_id( obj.get() )};
+          }
+
+          const auto tree_id = tag_tree( repo, object_id.substr( 0, pos ) );
+          if ( UNLIKELY( !tree_id ) ) return {};
+          const git_tree* tree = repo.trees().get( repo, &*tree_id );
+
+          auto path = object_id.substr( pos + 1 );
+          while ( tree && !path.empty() ) {
+            const auto sep  = path.find( '/' );
+            const bool last = sep == path.npos;
+            const auto name = std::string{path.substr( 0, sep )};
+            path.remove_prefix( last ? path.size() : sep + 1 );
+
+            const git_tree_entry* te = name.empty() ? nullptr : git_tree_entry_byname( tree, name.c_str() );
+            if ( UNLIKELY( !te ) ) return {};
+
+            if ( git_tree_entry_type( te ) == GIT_OBJ_TREE ) {
+              tree = repo.trees().get( repo, git_tree_entry_id( te ) );
+            } else if ( last ) {
+              return {git_tree_entry_type( te ), *git_tree_entry_id( te )};
+            } else {
+              return {};
+            }
+          }
+          if ( !tree ) return {};
+          return {GIT_OBJ_TREE, *git_tree_id( tree )};
+        }
+
+        object_ref get_object( git_repository_pool::handle& repo, const char* object_id,
+                               const std::string& obj_type = "object" ) const {
+          giterr_clear();
+          auto obj = find_object( repo, object_id );
+          if ( UNLIKELY( !obj ) ) {
+            const auto err = giterr_last();
+            throw std::runtime_error{"cannot resolve " + obj_type + " " + object_id + ": " +
+                                     ( err ? err->message : "not found" )};
+          }
+          return obj;
+        }
+
+        /// Return a new reference to a tree.
+        Helpers::git_tree_ptr tree_ref( git_repository* repo, const git_oid& id, const char* object_id ) const {
+          git_tree* tree = nullptr;
+          if ( UNLIKELY( git_tree_lookup( &tree, repo, &id ) ) )
+            throw std::runtime_error{std::string{"cannot read tree "} + object_id};
+          return Helpers::git_tree_ptr{tree};
+        }
+
+        /// Parsed content of the IOVs blob with the given id (cached).
+        std::shared_ptr<const Helpers::IOVIndex> iovs_index( git_repository* repo, const git_oid& id,
+                                                             const char* object_id ) const {
+          const std::string blob_id{reinterpret_cast<const char*>( id.id ), sizeof( id.id )};
+
+          std::lock_guard<std::mutex> guard( m_iovs_cache_mutex );
+          auto&                       index = m_iovs_cache[blob_id];
+          if ( !index ) {
+            const auto data = read_object( repo, id, object_id );
+            timer      t{metrics(), operation::iov_parse};
+            index = std::make_shared<const Helpers::IOVIndex>( data.data() );
+          }
+          return index;
+        }
+
+        /// Read the raw content of an object from the object database.
+        ///
+        /// The returned payload references the data owned by libgit2, which is released when the
+        /// last copy of the payload is destroyed (the object database objects do not depend on the
+        /// repository handle, so they can outlive it and be released from any thread).
+        Payload read_object( git_repository* repo, const git_oid& id, const char* object_id ) const {
+          timer t{metrics(), operation::blob_read};
+          auto odb = git_call<git_odb_ptr>( "cannot access object database for", object_id, git_repository_odb, repo );
+          std::shared_ptr<git_odb_object> raw =
+              git_call<git_odb_object_ptr>( "cannot read object", object_id, git_odb_read, odb.get(), &id );
+          const std::string_view data{static_cast<const char*>( git_odb_object_data( raw.get() ) ),
+                                      git_odb_object_size( raw.get() )};
+          return {std::move( raw ), data};
+        }
+
+        /// Same as read_object, but the payloads with the same blob id are shared while in use.
+        Payload shared_object( git_repository* repo, const git_oid& id, const char* object_id ) const {
+          return m_payloads.get( std::string{reinterpret_cast<const char*>( id.id ), sizeof( id.id )},
+                                 [&]() { return read_object( repo, id, object_id ); } );
+        }
+
+        /// Apply the (process-wide) libgit2 settings requested for this connection.
+        void configure( const GitOptions& options ) const {
+          auto set = [this]( const char* name, const std::optional<std::size_t>& value, auto... args ) {
+            if ( !value ) return;
+            debug( fmt::format( "setting libgit2 option {} to {}", name, *value ) );
+            if ( UNLIKELY( git_libgit2_opts( args..., *value ) ) )
+              throw std::runtime_error{fmt::format( "cannot set libgit2 option {}: {}", name, giterr_last()->message )};
+          };
+          if ( options.object_cache_size && *options.object_cache_size > std::numeric_limits<ssize_t>::max() )
+            throw std::invalid_argument{"object_cache_size too large"};
+          set( "object_cache_size", options.object_cache_size, GIT_OPT_SET_CACHE_MAX_SIZE );
+          set( "object_cache_blob_limit", options.object_cache_blob_limit, GIT_OPT_SET_CACHE_OBJECT_LIMIT,
+               GIT_OBJECT_BLOB );
+          set( "mwindow_size", options.mwindow_size, GIT_OPT_SET_MWINDOW_SIZE );
+          set( "mwindow_mapped_limit", options.mwindow_mapped_limit, GIT_OPT_SET_MWINDOW_MAPPED_LIMIT );
+          set( "open_packfiles", options.open_packfiles, GIT_OPT_SET_MWINDOW_FILE_LIMIT );
+        }
+
+        /// Take an idle handle on the repository from the registry or open a new one.
+        git_repository_pool::slot open_repository() const {
+          info( fmt::format( "opening Git repository '{}'", m_repository_url ) );
+          git_repository_pool::slot s;
+          if ( m_registry->take( m_registry_key, s ) ) return s;
+          s.repo = git_call<git_repository_pool::storage_t>( "cannot open repository", m_repository_url,
+                                                             git_repository_open, m_repository_url.c_str() );
+          if ( UNLIKELY( !s.repo ) ) throw std::runtime_error{"invalid Git repository: '" + m_repository_url + "'"};
+          return s;
+        }
+
+        /// Hand a handle (and its caches) to the registry, which closes it unless it keeps idle handles.
+        void release_repository( git_repository_pool::slot s ) const {
+          m_registry->put( m_registry_key, std::move( s ) );
         }
 
         std::string m_repository_url;
 
-        mutable git_repository_ptr m_repository;
+        /// Process-wide store of idle repository handles (kept alive as long as we need it).
+        std::shared_ptr<git_repository_registry> m_registry;
+        std::string                              m_registry_key;
+
+        /// Repository handles, one per concurrent user.
+        mutable git_repository_pool m_repository;
+
+        mutable std::map<std::string, git_oid, std::less<>> m_tags;
+        /// Trees of the full commit ids used as tags (never checked by update()).
+        mutable std::map<std::string, git_oid, std::less<>> m_commit_trees;
+        mutable std::mutex                                  m_tags_mutex;
+
+        mutable std::unordered_map<std::string, std::shared_ptr<const Helpers::IOVIndex>> m_iovs_cache;
+        mutable std::mutex                                                                 m_iovs_cache_mutex;
+
+        /// Payloads in use, by blob id.
+        mutable PayloadStore m_payloads;
       };
 
+      /// Access to a directory tree (the tag is ignored).
+      ///
+      /// The metadata needed to resolve paths comes from the directory listings, which are
+      /// read once and cached until refresh() is called, so that repeated lookups do not need
+      /// any system call (which is important on network filesystems).
+      /// Small files are read in memory, large files are memory mapped.
       class FilesystemImpl : public DBImpl {
       public:
+        /// Files of at least this size are memory mapped instead of read.
+        static constexpr std::size_t mmap_threshold = 64 * 1024;
+
         FilesystemImpl( std::string_view root, std::shared_ptr<Logger> logger = nullptr )
             : DBImpl{std::move( logger )}, m_root( root ) {
           info( fmt::format( "using files from '{}'", m_root.string() ) );
@@ -194,41 +787,49 @@ namespace GitCondDB {
 
         bool connected() const override { return true; }
 
+        std::string_view backend_name() const override { return "filesystem"; }
+
+        /// Files can be modified at any time, so their content cannot be identified by path (and
+        /// the data derived from it is not cached).
+        std::string content_id( const char* ) const override { return {}; }
+
+        /// Forget the cached directory listings.
+        void refresh() const override {
+          std::lock_guard<std::mutex> guard( m_listings_mutex );
+          m_listings.clear();
+        }
+
         bool exists( const char* object_id ) const override {
+          timer t{metrics(), operation::exists};
           // return true for any tag name (i.e. id without a ':') and existing paths
           const std::string_view id{object_id};
-          return id.find_first_of( ':' ) == id.npos || fs::exists( to_path( id ) );
+          return id.find_first_of( ':' ) == id.npos || type_of( strip_tag( id ) ) != entry_type::missing;
         }
 
-        std::variant<std::string, dir_content> get( const char* object_id ) const override {
-          std::variant<std::string, dir_content> out;
-          const auto                             path = to_path( object_id );
+        /// Large files are memory mapped, so that their content is not copied.
+        std::variant<Payload, dir_content> get_payload( const char* object_id ) const override {
+          timer                              t{metrics(), operation::get};
+          std::variant<Payload, dir_content> out;
+          const auto                         rel_path = strip_tag( object_id );
+          const auto                         path     = m_root / rel_path;
 
           debug( std::string{"accessing path "} + path.string() );
 
-          if ( is_directory( path ) ) {
+          const auto type = type_of( rel_path );
+          if ( type == entry_type::directory ) {
             debug( "found directory" );
 
             dir_content entries;
-            entries.root = strip_tag( object_id );
+            entries.root = rel_path;
 
-            for ( auto p : fs::directory_iterator( path ) ) {
-              ( is_directory( p.path() ) ? entries.dirs : entries.files ).emplace_back( p.path().filename() );
+            for ( const auto& [name, entry] : *list_dir( rel_path ) ) {
+              ( entry == entry_type::directory ? entries.dirs : entries.files ).emplace_back( name );
             }
 
             out = std::move( entries );
-          } else if ( is_regular_file( path ) ) {
+          } else if ( type == entry_type::regular ) {
             debug( "found regular file" );
-
-            std::ifstream stream{path.string()};
-            stream.seekg( 0, stream.end );
-            const auto size = stream.tellg();
-            stream.seekg( 0 );
-
-            std::string data( static_cast<std::size_t>( size ), 0 );
-            stream.read( data.data(), size );
-
-            out = std::move( data );
+            out = read_file( path );
           } else {
             throw std::runtime_error{std::string{"cannot resolve object "} + object_id};
           }
@@ -240,23 +841,118 @@ namespace GitCondDB {
         }
 
       private:
-        inline fs::path to_path( std::string_view object_id ) const { return m_root / strip_tag( object_id ); }
+        enum class entry_type { missing, regular, directory, other };
+        /// Entries of a directory, sorted by name.
+        using listing = std::vector<std::pair<std::string, entry_type>>;
+
+        /// Type of an entry from the listing of its parent directory.
+        entry_type type_of( std::string_view rel_path ) const {
+          if ( rel_path.empty() ) return entry_type::directory;
+          const auto pos  = rel_path.find_last_of( '/' );
+          const auto name = rel_path.substr( pos + 1 );
+          if ( UNLIKELY( name.empty() || name == "." || name == ".." ) ) {
+            // not in the listings, so we have to ask the filesystem
+            std::error_code ec;
+            return entry_type_of( fs::status( m_root / rel_path, ec ) );
+          }
+          const auto entries = list_dir( ( pos == rel_path.npos ) ? std::string_view{} : rel_path.substr( 0, pos ) );
+          const auto entry   = std::lower_bound( entries->begin(), entries->end(), name,
+                                               []( const auto& e, std::string_view n ) { return e.first < n; } );
+          return ( entry != entries->end() && entry->first == name ) ? entry->second : entry_type::missing;
+        }
+
+        /// Return the (cached) listing of a directory, which is empty if rel_path is not a directory.
+        std::shared_ptr<const listing> list_dir( std::string_view rel_path ) const {
+          std::string key{rel_path};
+          {
+            std::lock_guard<std::mutex> guard( m_listings_mutex );
+            if ( const auto cached = m_listings.find( key ); cached != m_listings.end() ) return cached->second;
+          }
+
+          auto            entries = std::make_shared<listing>();
+          std::error_code ec;
+          for ( fs::directory_iterator it{m_root / rel_path, ec}, end; !ec && it != end; it.increment( ec ) ) {
+            const auto type = entry_type_of( *it );
+            if ( type != entry_type::missing ) entries->emplace_back( it->path().filename().string(), type );
+          }
+          std::sort( entries->begin(), entries->end() );
+
+          std::lock_guard<std::mutex> guard( m_listings_mutex );
+          return m_listings.emplace( std::move( key ), std::move( entries ) ).first->second;
+        }
+
+        static entry_type entry_type_of( const fs::directory_entry& entry ) {
+          std::error_code ec;
+#if __GNUC__ >= 8
+          // the type is usually known from the directory listing, so no stat is needed
+          if ( entry.is_directory( ec ) ) return entry_type::directory;
+          if ( entry.is_regular_file( ec ) ) return entry_type::regular;
+          return entry.exists( ec ) ? entry_type::other : entry_type::missing;
+#else
+          return entry_type_of( entry.status( ec ) );
+#endif
+        }
+
+        static entry_type entry_type_of( const fs::file_status& st ) {
+          if ( fs::is_directory( st ) ) return entry_type::directory;
+          if ( fs::is_regular_file( st ) ) return entry_type::regular;
+          return fs::exists( st ) ? entry_type::other : entry_type::missing;
+        }
+
+        /// Return the content of a file, copied in memory if small or memory mapped if large.
+        Payload read_file( const fs::path& path ) const {
+          timer     t{metrics(), operation::blob_read};
+          const int fd = ::open( path.c_str(), O_RDONLY );
+          if ( UNLIKELY( fd < 0 ) ) throw std::runtime_error{"cannot open file " + path.string()};
+          struct stat st;
+          if ( UNLIKELY( fstat( fd, &st ) != 0 ) ) {
+            ::close( fd );
+            throw std::runtime_error{"cannot read file " + path.string()};
+          }
+          const auto size = static_cast<std::size_t>( st.st_size );
+
+          if ( size >= mmap_threshold ) {
+            const auto mapping = mapped_file::map( fd, size );
+            ::close( fd );
+            if ( UNLIKELY( !mapping ) ) throw std::runtime_error{"cannot map file " + path.string()};
+            const auto data = mapping->data();
+            return {mapping, data};
+          }
+
+          std::string data( size, '\0' );
+          std::size_t done = 0;
+          while ( done < size ) {
+            const auto n = ::read( fd, data.data() + done, size - done );
+            if ( n <= 0 ) {
+              if ( n < 0 && errno == EINTR ) continue;
+              break;
+            }
+            done += static_cast<std::size_t>( n );
+          }
+          ::close( fd );
+          // the file may have been truncated while reading
+          data.resize( done );
+          return Payload{std::move( data )};
+        }
 
         fs::path m_root;
+
+        mutable std::mutex                                                      m_listings_mutex;
+        mutable std::unordered_map<std::string, std::shared_ptr<const listing>> m_listings;
       };
 
+      /// Access to a JSON document, loaded in a JSONTree (streamed from the file, without
+      /// building the full nlohmann::json DOM).
       class JSONImpl : public DBImpl {
-        using json = nlohmann::json;
-
       public:
         JSONImpl( std::string_view data, std::shared_ptr<Logger> logger = nullptr ) : DBImpl{std::move( logger )} {
           if ( data.find_first_of( '{' ) != data.npos ) {
             info( "using JSON data from memory" );
-            m_json = json::parse( data );
+            m_json = JSONTree::parse( data );
           } else if ( is_regular_file( fs::path( data ) ) ) {
             info( fmt::format( "loading JSON data from '{}'", data ) );
             std::ifstream stream{std::string{data}};
-            stream >> m_json;
+            m_json = JSONTree::parse( stream );
           } else {
             throw std::runtime_error{"invalid JSON"};
           }
@@ -266,38 +962,42 @@ namespace GitCondDB {
 
         bool connected() const override { return true; }
 
+        std::string_view backend_name() const override { return "json"; }
+
         bool exists( const char* object_id ) const override {
+          timer t{metrics(), operation::exists};
           // return true for any tag name (i.e. id without a ':') and existing paths
           const std::string_view id{object_id};
-          return id.find_first_of( ':' ) == id.npos || !m_json.value( to_path( object_id ), json{} ).is_null();
+          return id.find_first_of( ':' ) == id.npos || m_json->find( strip_tag( id ) );
         }
 
-        std::variant<std::string, dir_content> get( const char* object_id ) const override {
-          std::variant<std::string, dir_content> out;
+        /// Strings are returned as views on the loaded JSON data.
+        std::variant<Payload, dir_content> get_payload( const char* object_id ) const override {
+          timer                              t{metrics(), operation::get};
+          std::variant<Payload, dir_content> out;
 
-          const auto path = to_path( object_id );
-          debug( fmt::format( "accessing entry '{}'", path.to_string() ) );
+          const auto path = strip_tag( object_id );
+          debug( fmt::format( "accessing entry '{}{}'", path.empty() ? "" : "/", path ) );
 
-          auto obj = m_json.value( path, json{} );
+          const auto node = m_json->find( path );
 
-          if ( UNLIKELY( obj.is_null() ) ) {
-            throw std::runtime_error{std::string{"cannot resolve object "} + object_id};
-          } else if ( obj.is_object() ) {
+          if ( UNLIKELY( !node ) ) throw std::runtime_error{std::string{"cannot resolve object "} + object_id};
+          if ( node->type == JSONTree::node_type::object ) {
             debug( "found object" );
 
             dir_content entries;
 
-            entries.root = strip_tag( object_id );
+            entries.root = path;
 
-            // for(const auto& elem: )
-            for ( auto it = obj.begin(); it != obj.end(); ++it ) {
-              ( it.value().is_object() ? entries.dirs : entries.files ).emplace_back( it.key() );
-            }
+            m_json->for_each_child( *node, [&entries, this]( const JSONTree::node& child ) {
+              ( child.type == JSONTree::node_type::object ? entries.dirs : entries.files )
+                  .emplace_back( m_json->key( child ) );
+            } );
 
             out = std::move( entries );
-          } else if ( LIKELY( obj.is_string() ) ) {
+          } else if ( LIKELY( node->type == JSONTree::node_type::string ) ) {
             debug( "found string" );
-            out = std::string{obj};
+            out = Payload{m_json, m_json->value( *node )};
           } else {
             throw std::runtime_error{std::string{"invalid type at "} + object_id};
           }
@@ -309,12 +1009,228 @@ namespace GitCondDB {
         }
 
       private:
-        inline json::json_pointer to_path( std::string_view object_id ) const {
-          const auto path = strip_tag( object_id );
-          return json::json_pointer{path.empty() ? std::string{} : std::string{'/'} + std::string{path}};
+        /// The data is shared with the payloads returned by get_payload.
+        std::shared_ptr<const JSONTree> m_json;
+      };
+
+      /// Read-only access to a snapshot file (see snapshot_format.h and SnapshotWriter).
+      ///
+      /// The file is memory mapped and used as it is: paths are resolved with binary searches
+      /// in the sorted lists of directory entries, payloads are views on the mapped data and
+      /// IOVs files are served from their pre-parsed tables.
+      /// The snapshot contains only one tag, so object ids with other tags are not found.
+      class SnapshotImpl : public DBImpl {
+      public:
+        SnapshotImpl( std::string_view path, std::shared_ptr<Logger> logger = nullptr ) : DBImpl{std::move( logger )} {
+          info( fmt::format( "using snapshot file '{}'", path ) );
+          m_file = mapped_file::open( fs::path{std::string{path}} );
+
+          const auto invalid = [&path]( std::string_view reason ) {
+            return std::runtime_error{fmt::format( "invalid snapshot file {}: {}", path, reason )};
+          };
+          const auto data = m_file->data();
+          if ( UNLIKELY( data.size() < sizeof( snapshot::header ) ) ) throw invalid( "too short" );
+          m_header = reinterpret_cast<const snapshot::header*>( data.data() );
+          if ( UNLIKELY( !std::equal( std::begin( snapshot::magic ), std::end( snapshot::magic ), m_header->magic ) ) )
+            throw invalid( "wrong signature" );
+          if ( UNLIKELY( m_header->version != snapshot::version ) )
+            throw invalid( fmt::format( "unsupported version {}", m_header->version ) );
+          if ( UNLIKELY( m_header->byte_order != snapshot::byte_order ) ) throw invalid( "wrong byte order" );
+
+          const auto in_file = [&data]( const snapshot::section& s, std::uint64_t element_size ) {
+            return s.offset % 8 == 0 && s.offset <= data.size() && s.size <= ( data.size() - s.offset ) / element_size;
+          };
+          if ( UNLIKELY( !in_file( m_header->nodes, sizeof( snapshot::node ) ) || m_header->nodes.size == 0 ||
+                         !in_file( m_header->iov_tables, sizeof( snapshot::iov_table ) ) ||
+                         !in_file( m_header->arrays, 1 ) || !in_file( m_header->data, 1 ) ) )
+            throw invalid( "corrupted header" );
+
+          m_nodes      = reinterpret_cast<const snapshot::node*>( data.data() + m_header->nodes.offset );
+          m_iov_tables = reinterpret_cast<const snapshot::iov_table*>( data.data() + m_header->iov_tables.offset );
+          m_arrays     = data.substr( m_header->arrays.offset, m_header->arrays.size );
+          m_data       = data.substr( m_header->data.offset, m_header->data.size );
+          m_tag        = str( m_header->tag );
+        }
+
+        void disconnect() const override {}
+
+        bool connected() const override { return true; }
+
+        std::string_view backend_name() const override { return "snapshot"; }
+
+        /// Name of the tag stored in the snapshot.
+        std::string_view tag() const { return m_tag; }
+        /// Range of time points for which the snapshot can be used.
+        CondDB::IOV range() const { return {m_header->since, m_header->until}; }
+
+        bool exists( const char* object_id ) const override {
+          timer                  t{metrics(), operation::exists};
+          const std::string_view id{object_id};
+          return id.find_first_of( ':' ) == id.npos ? id == m_tag : find_node( id ) != nullptr;
         }
 
-        json m_json;
+        std::variant<Payload, dir_content> get_payload( const char* object_id ) const override {
+          timer t{metrics(), operation::get};
+          debug( std::string{"accessing snapshot entry "} + object_id );
+          const auto& node = get_node( object_id );
+          if ( node.type == snapshot::directory ) {
+            debug( "found directory" );
+            dir_content entries;
+            entries.root = strip_tag( object_id );
+            for ( const auto& entry : children( node ) ) {
+              ( entry.type == snapshot::directory ? entries.dirs : entries.files ).emplace_back( str( entry.name ) );
+            }
+            return entries;
+          }
+          debug( "found file" );
+          return content( node );
+        }
+
+        /// Directories with an IOVs file are resolved directly to the tables of the file.
+        std::shared_ptr<const Helpers::IOVIndex> get_iovs( const char* object_id ) const override {
+          std::string_view id{object_id};
+          if ( const auto pos = id.find_last_of( ":/" ); pos != id.npos && id.substr( pos + 1 ) == "IOVs" ) {
+            // the parent of "tag:IOVs" is "tag:"
+            const auto dir = find_node( id.substr( 0, id[pos] == ':' ? pos + 1 : pos ) );
+            if ( dir && dir->iovs != snapshot::no_iovs ) return iovs_index( dir->iovs );
+          }
+          return DBImpl::get_iovs( object_id );
+        }
+
+        std::variant<Payload, directory> lookup( const char* object_id ) const override {
+          timer t{metrics(), operation::get};
+          debug( std::string{"lookup snapshot entry "} + object_id );
+          const auto& node = get_node( object_id );
+          if ( node.type != snapshot::directory ) {
+            debug( "found file" );
+            return content( node );
+          }
+          debug( "found directory" );
+
+          directory out;
+          if ( node.iovs != snapshot::no_iovs ) {
+            out.iovs = iovs_index( node.iovs );
+            return out;
+          }
+          out.content.root = strip_tag( object_id );
+          for ( const auto& entry : children( node ) ) {
+            const bool file = entry.type != snapshot::directory || entry.iovs != snapshot::no_iovs;
+            ( file ? out.content.files : out.content.dirs ).emplace_back( str( entry.name ) );
+          }
+          return out;
+        }
+
+        std::shared_ptr<const Helpers::IOVIndex> find_iovs( const char* object_id ) const override {
+          const auto node = find_node( object_id );
+          if ( !node || node->type != snapshot::directory || node->iovs == snapshot::no_iovs ) return nullptr;
+          return iovs_index( node->iovs );
+        }
+
+        std::chrono::system_clock::time_point commit_time( const char* commit_id ) const override {
+          if ( UNLIKELY( commit_id != m_tag ) )
+            throw std::runtime_error{std::string{"cannot resolve commit "} + commit_id + ": not in snapshot"};
+          if ( m_header->commit_time == snapshot::no_commit_time )
+            return std::chrono::time_point<std::chrono::system_clock>::max();
+          return std::chrono::system_clock::from_time_t( static_cast<std::time_t>( m_header->commit_time ) );
+        }
+
+      private:
+        struct node_range {
+          const snapshot::node* first;
+          const snapshot::node* last;
+
+          const snapshot::node* begin() const { return first; }
+          const snapshot::node* end() const { return last; }
+        };
+
+        [[noreturn]] void corrupted() const { throw std::runtime_error{"corrupted snapshot file"}; }
+
+        node_range children( const snapshot::node& dir ) const {
+          if ( UNLIKELY( dir.first > m_header->nodes.size || dir.size > m_header->nodes.size - dir.first ) )
+            corrupted();
+          return {m_nodes + dir.first, m_nodes + dir.first + dir.size};
+        }
+
+        std::string_view str( const snapshot::string_ref& ref ) const {
+          if ( UNLIKELY( ref.offset > m_data.size() || ref.size > m_data.size() - ref.offset ) ) corrupted();
+          return m_data.substr( ref.offset, ref.size );
+        }
+
+        Payload content( const snapshot::node& file ) const { return {m_file, str( {file.first, file.size} )}; }
+
+        /// Look for the entry for an object id, returning nullptr if it does not exist.
+        const snapshot::node* find_node( std::string_view object_id ) const {
+          const auto pos = object_id.find_first_of( ':' );
+          if ( pos == object_id.npos || object_id.substr( 0, pos ) != m_tag ) return nullptr;
+
+          const snapshot::node* node = m_nodes; // root
+          auto                  path = object_id.substr( pos + 1 );
+          while ( !path.empty() ) {
+            if ( node->type != snapshot::directory ) return nullptr;
+            const auto sep  = path.find( '/' );
+            const auto name = path.substr( 0, sep );
+            path.remove_prefix( sep == path.npos ? path.size() : sep + 1 );
+
+            const auto entries = children( *node );
+            node               = std::lower_bound( entries.begin(), entries.end(), name,
+                                     [this]( const snapshot::node& entry, std::string_view name ) {
+                                       return str( entry.name ) < name;
+                                     } );
+            if ( node == entries.end() || str( node->name ) != name ) return nullptr;
+          }
+          return node;
+        }
+
+        const snapshot::node& get_node( const char* object_id ) const {
+          const auto node = find_node( object_id );
+          if ( UNLIKELY( !node ) ) throw std::runtime_error{std::string{"cannot resolve object "} + object_id};
+          return *node;
+        }
+
+        /// View on an array in the arrays section.
+        template <class T>
+        const T* array( std::uint64_t offset, std::uint64_t size ) const {
+          if ( UNLIKELY( offset % alignof( T ) || offset > m_arrays.size() ||
+                         size > ( m_arrays.size() - offset ) / sizeof( T ) ) )
+            corrupted();
+          return reinterpret_cast<const T*>( m_arrays.data() + offset );
+        }
+
+        /// Index of an IOVs table (the arrays are not copied, the index is created once and cached).
+        std::shared_ptr<const Helpers::IOVIndex> iovs_index( std::uint32_t n ) const {
+          std::lock_guard<std::mutex> guard( m_iovs_cache_mutex );
+          auto&                       index = m_iovs_cache[n];
+          if ( !index ) {
+            if ( UNLIKELY( n >= m_header->iov_tables.size ) ) corrupted();
+            const auto& tbl   = m_iov_tables[n];
+            auto        table = [this, &tbl]( const snapshot::table& t ) -> Helpers::IOVIndex::Table {
+              const auto key_ids = array<std::uint32_t>( t.key_ids, t.size );
+              const auto invalid_key = [&tbl]( std::uint32_t id ) { return id >= tbl.n_keys; };
+              if ( UNLIKELY( std::any_of( key_ids, key_ids + t.size, invalid_key ) ) ) corrupted();
+              return {array<CondDB::time_point_t>( t.since, t.size ), key_ids,
+                      array<CondDB::time_point_t>( t.max_since, t.size ), t.size};
+            };
+            std::vector<std::string_view> keys;
+            keys.reserve( tbl.n_keys );
+            const auto key_refs = array<snapshot::string_ref>( tbl.keys, tbl.n_keys );
+            for ( std::size_t i = 0; i < tbl.n_keys; ++i ) keys.push_back( str( key_refs[i] ) );
+            index = std::make_shared<const Helpers::IOVIndex>( table( tbl.all ), table( tbl.reduced ),
+                                                               std::move( keys ), m_file );
+          }
+          return index;
+        }
+
+        std::shared_ptr<const mapped_file> m_file;
+
+        const snapshot::header*    m_header     = nullptr;
+        const snapshot::node*      m_nodes      = nullptr;
+        const snapshot::iov_table* m_iov_tables = nullptr;
+        std::string_view           m_arrays;
+        std::string_view           m_data;
+        std::string_view           m_tag;
+
+        mutable std::unordered_map<std::uint32_t, std::shared_ptr<const Helpers::IOVIndex>> m_iovs_cache;
+        mutable std::mutex                                                                   m_iovs_cache_mutex;
       };
     } // namespace details
   }   // namespace v1
@@ -14,13 +14,25 @@
 
 #include "DBImpl.h"
 
+#include "IOVBoundariesCache.h"
+#include "PayloadCache.h"
+#include "SnapshotWriter.h"
+#include "TaskPool.h"
+#include "Watcher.h"
 #include "iov_helpers.h"
+#include "path_helpers.h"
 
 #include "BasicLogger.h"
 
-#include <regex>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <numeric>
 #include <sstream>
+#include <thread>
 #include <tuple>
+#include <unordered_map>
 
 #include <nlohmann/json.hpp>
 
@@ -29,25 +41,75 @@
 using namespace GitCondDB::v1;
 
 namespace {
-  /// helper to normalize relative paths
-  std::string normalize( std::string path ) {
-    // regex for entries to be removed, i.e. "/parent/../" and "/./"
-    static const std::regex ignored_re{"(/[^/]+/\\.\\./)|(/\\./)"};
-    std::string             old_path;
-    while ( old_path.length() != path.length() ) {
-      old_path.swap( path );
-      path = std::regex_replace( old_path, ignored_re, "/" );
+  using GitCondDB::Helpers::normalize;
+
+  inline std::string format_obj_id( std::string_view tag, std::string_view path ) {
+    std::string out{tag};
+    out += ':';
+    out += normalize( path );
+    return out;
+  }
+  inline std::string format_obj_id( const CondDB::Key& key ) { return format_obj_id( key.tag, key.path ); }
+
+  /// Id of an entry referenced in the IOVs file of object_id (not normalized).
+  inline std::string child_iovs_id( std::string_view object_id, std::string_view key ) {
+    std::string out{object_id};
+    out += '/';
+    out += key;
+    return out;
+  }
+
+  /// Reduce scope to the longest directory containing both scope and path.
+  void narrow_scope( std::string& scope, std::string_view path ) {
+    std::size_t common = 0;
+    for ( std::size_t i = 0; i <= scope.size() && i <= path.size(); ++i ) {
+      const bool scope_end = i == scope.size() || scope[i] == '/';
+      const bool path_end  = i == path.size() || path[i] == '/';
+      if ( scope_end && path_end ) {
+        common = i;
+      } else if ( scope_end || path_end || scope[i] != path[i] ) {
+        break;
+      }
     }
-    return path;
+    scope.resize( common );
   }
 
-  inline std::string format_obj_id( const std::string& tag, const std::string& path ) {
-    return tag + ':' + normalize( path );
+  /// Call f( i ) for i in [0, n) from n_threads threads, stopping at the first exception (rethrown).
+  template <class FUNC>
+  void parallel_for( std::size_t n, std::size_t n_threads, FUNC&& f ) {
+    if ( UNLIKELY( !n ) ) return;
+
+    std::atomic<std::size_t> next{0};
+    std::exception_ptr       error;
+    std::mutex               error_mutex;
+    auto                     worker = [&]() {
+      for ( std::size_t i = next++; i < n; i = next++ ) {
+        try {
+          f( i );
+        } catch ( ... ) {
+          std::lock_guard<std::mutex> guard( error_mutex );
+          if ( !error ) error = std::current_exception();
+          next = n; // stop all workers
+        }
+      }
+    };
+
+    n_threads = std::clamp<std::size_t>( n_threads, 1, n );
+    std::vector<std::thread> threads;
+    threads.reserve( n_threads - 1 );
+    for ( std::size_t i = 1; i < n_threads; ++i ) threads.emplace_back( worker );
+    worker();
+    for ( auto& t : threads ) t.join();
+
+    if ( error ) std::rethrow_exception( error );
   }
-  inline std::string format_obj_id( const std::string_view& tag, const std::string_view& path ) {
-    return format_obj_id( std::string{tag}, std::string{path} );
+
+  /// Content id of an object, or the object id itself if the backend cannot identify the content
+  /// (good enough to recognize identical objects within one call).
+  std::string content_or_object_id( const details::DBImpl& impl, const std::string& object_id ) {
+    auto id = impl.content_id( object_id.c_str() );
+    return id.empty() ? object_id : id;
   }
-  inline std::string format_obj_id( const CondDB::Key& key ) { return format_obj_id( key.tag, key.path ); }
 
   std::string json_dir_converter( const CondDB::dir_content& content ) {
     using json = nlohmann::json;
@@ -56,7 +118,10 @@ namespace {
 } // namespace
 
 CondDB::CondDB( std::unique_ptr<details::DBImpl> impl )
-    : m_impl{std::move( impl )}, m_dir_converter{json_dir_converter} {
+    : m_impl{std::move( impl )}
+    , m_dir_converter{json_dir_converter}
+    , m_boundaries_cache{std::make_unique<details::IOVBoundariesCache>()}
+    , m_workers{std::make_unique<details::TaskPool>( 2 )} {
   assert( m_impl );
 }
 
@@ -70,36 +135,273 @@ Logger* CondDB::logger() const { return m_impl->logger(); }
 
 void CondDB::disconnect() const { m_impl->disconnect(); }
 
+void CondDB::refresh() const {
+  m_impl->refresh();
+  clear_payload_cache();
+  m_boundaries_cache->clear();
+}
+
+std::vector<std::string> CondDB::update() const {
+  auto changes = m_impl->update();
+  if ( m_payload_cache && !changes.empty() ) {
+    // group the changed paths by tag
+    std::map<std::string_view, std::vector<std::string>> paths;
+    for ( std::string_view id : changes ) {
+      const auto pos = id.find_first_of( ':' );
+      paths[id.substr( 0, pos )].emplace_back( id.substr( pos + 1 ) );
+    }
+    for ( const auto& [tag, tag_paths] : paths ) {
+      const auto count = m_payload_cache->invalidate( tag, tag_paths );
+      m_impl->debug( fmt::format( "dropped {} cached payloads of tag '{}'", count, tag ) );
+    }
+  }
+  return changes;
+}
+
+void CondDB::watch( std::function<void( const std::vector<std::string>& )> callback ) {
+  m_watcher.reset();
+  auto paths = m_impl->watch_paths();
+  if ( UNLIKELY( paths.empty() ) )
+    throw std::runtime_error{fmt::format( "cannot watch for changes in the {} backend", m_impl->backend_name() )};
+  m_watcher = std::make_unique<details::Watcher>( paths, [this, callback = std::move( callback )]() {
+    try {
+      if ( const auto changes = update(); !changes.empty() ) callback( changes );
+    } catch ( const std::exception& err ) {
+      m_impl->warning( fmt::format( "failed to update after a change in the repository: {}", err.what() ) );
+    }
+  } );
+}
+
+void CondDB::stop_watching() { m_watcher.reset(); }
+
 bool CondDB::connected() const { return m_impl->connected(); }
 
+void CondDB::set_iov_reduction( bool value ) {
+  if ( value != m_reduce_iovs ) clear_payload_cache();
+  m_reduce_iovs = value;
+}
+
+void CondDB::enable_payload_cache( std::size_t max_entries, std::size_t max_bytes ) {
+  m_payload_cache = std::make_unique<details::PayloadCache>( max_entries, max_bytes );
+}
+
+void CondDB::disable_payload_cache() { m_payload_cache.reset(); }
+
+void CondDB::clear_payload_cache() const {
+  if ( m_payload_cache ) m_payload_cache->clear();
+}
+
+CondDB::cache_stats CondDB::payload_cache_stats() const {
+  return m_payload_cache ? m_payload_cache->stats() : cache_stats{};
+}
+
+CondDB::dedup_stats CondDB::payload_dedup_stats() const { return m_impl->dedup_stats(); }
+
+std::string_view CondDB::operation_name( operation op ) {
+  switch ( op ) {
+  case operation::get:
+    return "get";
+  case operation::exists:
+    return "exists";
+  case operation::iov_parse:
+    return "iov_parse";
+  case operation::revparse:
+    return "revparse";
+  case operation::blob_read:
+    return "blob_read";
+  case operation::dir_conversion:
+    return "dir_conversion";
+  }
+  return "unknown";
+}
+
+void CondDB::enable_metrics( bool value ) { m_impl->metrics().enable( value ); }
+
+bool CondDB::metrics_enabled() const { return m_impl->metrics().enabled(); }
+
+CondDB::metrics_stats CondDB::metrics() const { return m_impl->metrics().snapshot( m_impl->backend_name() ); }
+
+void CondDB::reset_metrics() const { m_impl->metrics().reset(); }
+
 std::tuple<std::string, CondDB::IOV> CondDB::get( const Key& key, const IOV& bounds ) const {
+  auto [data, iov] = get( key, key, bounds );
+  return {data.str(), iov};
+}
+
+std::tuple<CondDB::Payload, CondDB::IOV> CondDB::get_payload( const Key& key, const IOV& bounds ) const {
+  return get( key, key, bounds );
+}
+
+std::tuple<CondDB::Payload, CondDB::IOV> CondDB::get( const Key& key, const Key& lookup_key,
+                                                      const IOV& bounds ) const {
+  resolution how;
+  if ( !m_payload_cache ) return resolve( lookup_key, bounds, how );
+
+  const auto generation = m_payload_cache->generation();
+  if ( auto cached = m_payload_cache->find( key, bounds ) ) return std::move( *cached );
+
+  // a time point outside the bounds does not need to be looked up (and cannot be cached)
+  if ( UNLIKELY( !bounds.contains( key.time_point ) ) ) return resolve( lookup_key, bounds, how );
+
+  // resolve without bounds, so that the cached IOV can be used for any other request
+  std::string scope{normalize( lookup_key.path )};
+  auto [data, iov] = resolve( lookup_key, {}, how, &scope );
+  if ( how == resolution::directory ) return {std::move( data ), iov};
+  m_payload_cache->insert( key, data, iov, how == resolution::iov_blob, std::move( scope ), generation );
+  return {std::move( data ), iov.intersect( bounds )};
+}
+
+std::vector<std::tuple<std::string, CondDB::IOV>> CondDB::get_many( const std::vector<Key>& keys, const IOV& bounds,
+                                                                    std::size_t n_threads ) const {
+  std::vector<std::tuple<std::string, IOV>> out( keys.size() );
+  if ( UNLIKELY( keys.empty() ) ) return out;
+
+  // sort the requests by tag and path, so that lookups of nearby objects are close in time,
+  // and look up only once identical keys
+  std::vector<std::size_t> order( keys.size() );
+  std::iota( begin( order ), end( order ), 0 );
+  auto as_tuple = [&keys]( std::size_t i ) { return std::tie( keys[i].tag, keys[i].path, keys[i].time_point ); };
+  std::sort( begin( order ), end( order ),
+             [&as_tuple]( std::size_t a, std::size_t b ) { return as_tuple( a ) < as_tuple( b ); } );
+  std::vector<std::size_t> unique_keys;
+  unique_keys.reserve( keys.size() );
+  for ( std::size_t i : order ) {
+    if ( unique_keys.empty() || as_tuple( unique_keys.back() ) != as_tuple( i ) ) unique_keys.push_back( i );
+  }
+
+  parallel_for( unique_keys.size(), n_threads, [&]( std::size_t n ) {
+    const auto& key     = keys[unique_keys[n]];
+    auto [data, iov]    = get( key, key, bounds );
+    out[unique_keys[n]] = {data.str(), iov};
+  } );
+
+  // copy the results to the duplicated keys
+  for ( std::size_t i = 1; i < order.size(); ++i ) {
+    if ( as_tuple( order[i] ) == as_tuple( order[i - 1] ) ) out[order[i]] = out[order[i - 1]];
+  }
+
+  return out;
+}
+
+CondDB::tags_payloads CondDB::get_in_tags( const std::vector<std::string>& tags, std::string_view path,
+                                           time_point_t time_point, std::size_t n_threads ) const {
+  tags_payloads out;
+  out.group_of.resize( tags.size() );
+  out.iovs.resize( tags.size() );
+
+  // find the content each tag resolves to, without reading it
+  std::vector<std::string> content_ids( tags.size() );
+  parallel_for( tags.size(), n_threads, [&]( std::size_t i ) {
+    const auto [object_id, iov] = locate( {tags[i], std::string{path}, time_point}, {} );
+    if ( !object_id.empty() ) content_ids[i] = content_or_object_id( *m_impl, object_id );
+    out.iovs[i] = iov;
+  } );
+
+  // group the tags (unidentified payloads are not grouped)
+  std::unordered_map<std::string_view, std::size_t> groups;
+  for ( std::size_t i = 0; i < tags.size(); ++i ) {
+    auto group = groups.end();
+    if ( !content_ids[i].empty() ) group = groups.find( content_ids[i] );
+    if ( group == groups.end() ) {
+      if ( !content_ids[i].empty() ) group = groups.emplace( content_ids[i], out.groups.size() ).first;
+      out.group_of[i] = out.groups.size();
+      out.groups.push_back( {content_ids[i], {}, {}} );
+    } else {
+      out.group_of[i] = group->second;
+    }
+    out.groups[out.group_of[i]].tags.push_back( i );
+  }
+
+  // read each distinct payload once, through the first tag using it
+  parallel_for( out.groups.size(), n_threads, [&]( std::size_t g ) {
+    auto&             group = out.groups[g];
+    const std::size_t i     = group.tags.front();
+    const Key         key{tags[i], std::string{path}, time_point};
+    auto [payload, iov] = get( key, key, {} );
+    group.payload       = std::move( payload );
+    out.iovs[i]         = iov;
+  } );
+
+  return out;
+}
+
+std::future<std::tuple<std::string, CondDB::IOV>> CondDB::get_async( const Key& key, const IOV& bounds ) const {
+  return m_workers->submit( [this, key, bounds]() { return get( key, bounds ); } );
+}
+
+std::future<void> CondDB::prefetch( std::string_view tag, const std::vector<std::string>& paths,
+                                    time_point_t time_point ) const {
+  struct progress {
+    std::atomic<std::size_t> pending;
+    std::promise<void>       done;
+    std::mutex               error_mutex;
+    std::exception_ptr       error;
+  };
+  auto state     = std::make_shared<progress>();
+  state->pending = paths.size();
+  auto result    = state->done.get_future();
+  if ( UNLIKELY( paths.empty() ) ) {
+    state->done.set_value();
+    return result;
+  }
+
+  // one task per path, the last one to complete reports the result
+  for ( const auto& path : paths ) {
+    m_workers->post( [this, state, key = Key{std::string{tag}, path, time_point}]() {
+      try {
+        get_payload( key );
+      } catch ( ... ) {
+        std::lock_guard<std::mutex> guard( state->error_mutex );
+        if ( !state->error ) state->error = std::current_exception();
+      }
+      if ( --state->pending == 0 ) {
+        if ( state->error ) {
+          state->done.set_exception( state->error );
+        } else {
+          state->done.set_value();
+        }
+      }
+    } );
+  }
+  return result;
+}
+
+void CondDB::set_async_threads( std::size_t n_threads ) {
+  m_workers = std::make_unique<details::TaskPool>( n_threads );
+}
+
+std::size_t CondDB::async_threads() const { return m_workers->size(); }
+
+std::tuple<CondDB::Payload, CondDB::IOV> CondDB::resolve( const Key& key, const IOV& bounds, resolution& how,
+                                                          std::string* scope ) const {
   const std::string object_id = format_obj_id( key );
-  auto              data      = m_impl->get( object_id.c_str() );
+  if ( scope ) narrow_scope( *scope, details::DBImpl::strip_tag( object_id ) );
+  auto              data      = m_impl->lookup( object_id.c_str() );
   if ( data.index() == 1 ) { // we got a directory
-    auto& content = std::get<1>( data );
-    if ( find( begin( content.files ), end( content.files ), "IOVs" ) != end( content.files ) ) {
-      auto info = GitCondDB::Helpers::get_key_iov( std::get<0>( m_impl->get( ( object_id + "/IOVs" ).c_str() ) ),
-                                                   key.time_point, bounds, m_reduce_iovs );
-      if ( LIKELY( std::get<1>( info ).valid() ) ) {
+    auto& dir = std::get<1>( data );
+    if ( dir.iovs ) {
+      const auto [id, iov] = dir.iovs->find( key.time_point, bounds, m_reduce_iovs );
+      if ( LIKELY( iov.valid() ) ) {
         Key new_key = key;
-        new_key.path += '/' + std::get<0>( info );
-        return get( new_key, std::get<1>( info ) );
+        new_key.path += '/';
+        new_key.path += id;
+        auto result = resolve( new_key, iov, how, scope );
+        if ( how == resolution::blob ) how = resolution::iov_blob;
+        return result;
       } else {
-        return info;
+        how = resolution::iov_blob;
+        return {Payload{std::string{id}}, iov};
       }
     } else {
-      std::vector<std::string> dirs;
-      auto&                    files = content.files;
-      dirs.reserve( content.dirs.size() );
-      for ( auto& f : content.dirs ) {
-        ( m_impl->exists( ( object_id + '/' + f + "/IOVs" ).c_str() ) ? files : dirs ).emplace_back( std::move( f ) );
-      }
-      content.dirs = std::move( dirs );
+      auto& content = dir.content;
       std::sort( begin( content.files ), end( content.files ) );
       std::sort( begin( content.dirs ), end( content.dirs ) );
-      return {m_dir_converter( content ), {}};
+      how = resolution::directory;
+      details::Metrics::timer t{m_impl->metrics(), operation::dir_conversion};
+      return {Payload{m_dir_converter( content )}, {}};
     }
   } else {
+    how = resolution::blob;
     return {std::get<0>( data ), bounds};
   }
 }
@@ -108,47 +410,294 @@ std::chrono::system_clock::time_point CondDB::commit_time( const std::string& co
   return m_impl->commit_time( commit_id.c_str() );
 }
 
+void CondDB::export_snapshot( std::string_view tag, const std::string& path, const IOV& range ) const {
+  m_impl->info( fmt::format( "exporting tag '{}' to snapshot file '{}'", tag, path ) );
+  if ( range.since != IOV::min() || range.until != IOV::max() )
+    m_impl->info( fmt::format( "restricted to range [{}, {})", range.since, range.until ) );
+  const details::SnapshotWriter writer{*m_impl, tag, range};
+  writer.write( path );
+  m_impl->info( fmt::format( "written {} entries", writer.entries() ) );
+}
+
 CondDB GitCondDB::v1::connect( std::string_view repository, std::shared_ptr<Logger> logger ) {
+  return connect( repository, GitOptions{}, std::move( logger ) );
+}
+
+CondDB GitCondDB::v1::connect( std::string_view repository, const GitOptions& options,
+                               std::shared_ptr<Logger> logger ) {
   if ( !logger ) logger = std::make_shared<BasicLogger>();
 
   if ( repository.substr( 0, 5 ) == "file:" ) {
     return {std::make_unique<details::FilesystemImpl>( repository.substr( 5 ), std::move( logger ) )};
   } else if ( repository.substr( 0, 5 ) == "json:" ) {
     return {std::make_unique<details::JSONImpl>( repository.substr( 5 ), std::move( logger ) )};
+  } else if ( repository.substr( 0, 9 ) == "snapshot:" ) {
+    return {std::make_unique<details::SnapshotImpl>( repository.substr( 9 ), std::move( logger ) )};
   } else if ( repository.substr( 0, 4 ) == "git:" ) {
-    return {std::make_unique<details::GitImpl>( repository.substr( 4 ), std::move( logger ) )};
+    return {std::make_unique<details::GitImpl>( repository.substr( 4 ), std::move( logger ), options )};
   } else {
-    return {std::make_unique<details::GitImpl>( repository, std::move( logger ) )};
+    return {std::make_unique<details::GitImpl>( repository, std::move( logger ), options )};
   }
 }
 
-void CondDB::iov_boundaries_accumulate( const std::string& object_id, const CondDB::IOV& limits,
-                                        std::vector<std::pair<CondDB::IOV, std::string>>& acc ) const {
+void GitCondDB::v1::keep_idle_repositories( std::size_t max_per_repository ) {
+  Helpers::git_repository_registry::instance()->set_max_idle( max_per_repository );
+}
+
+void GitCondDB::v1::close_idle_repositories() { Helpers::git_repository_registry::instance()->clear(); }
+
+std::shared_ptr<const details::IOVBoundaries> CondDB::flat_iovs( const std::string& object_id, std::string& scope,
+                                                                 const details::IOVTree* tree ) const {
+  const auto path = details::DBImpl::strip_tag( object_id );
+
+  std::string                                   content_id;
+  std::shared_ptr<const details::IOVBoundaries> cached;
+  std::shared_ptr<const Helpers::IOVIndex>      iovs;
+  if ( tree ) {
+    const auto& node = tree->nodes.at( object_id );
+    content_id       = node.content_id;
+    cached           = node.cached;
+    iovs             = node.iovs;
+  } else {
+    content_id = m_impl->content_id( object_id.c_str() );
+    if ( !content_id.empty() ) cached = m_boundaries_cache->find( content_id );
+    if ( !cached ) iovs = m_impl->find_iovs( object_id.c_str() );
+  }
+
+  // only the entries that do not refer to anything outside of their directory are cached,
+  // so the scope of a cached entry is its own path
+  if ( cached ) {
+    narrow_scope( scope, path );
+    return cached;
+  }
+
+  auto        out = std::make_shared<details::IOVBoundaries>();
+  std::string own_scope{path};
   // get all iovs in the current obj_id
-  auto iovs_file = object_id + "/IOVs";
-  if ( !m_impl->exists( iovs_file.c_str() ) ) {
-    acc.emplace_back( limits, object_id );
+  if ( iovs ) {
+    for ( std::size_t i = 0; i < iovs->size(); ++i ) {
+      const auto iov = iovs->iov( i );
+      if ( !iov.valid() ) continue;
+      const auto child_id = child_iovs_id( object_id, iovs->key( i ) );
+      // the directories traversed going up (e.g. "A/B" with "../B/x") are part of the scope, as
+      // the result depends on their names too
+      for ( auto pos = child_id.find( "/..", object_id.size() ); pos != child_id.npos;
+            pos      = child_id.find( "/..", pos + 3 ) ) {
+        if ( pos + 3 < child_id.size() && child_id[pos + 3] != '/' ) continue;
+        narrow_scope( own_scope, details::DBImpl::strip_tag( normalize( child_id.substr( 0, pos + 3 ) + '/' ) ) );
+      }
+      out->append( *flat_iovs( normalize( child_id ), own_scope, tree ), iov );
+    }
   } else {
-    const auto tmp = Helpers::parse_IOVs_keys( std::get<0>( m_impl->get( iovs_file.c_str() ) ) );
-    std::for_each( begin( tmp ), end( tmp ), [&acc, &object_id, &limits, this]( const auto& entry ) {
-      if ( limits.overlaps( entry.first ) )
-        iov_boundaries_accumulate( normalize( object_id + '/' + entry.second ), limits.intersect( entry.first ), acc );
-    } );
+    out->iovs.emplace_back();
+  }
+
+  // entries without IOVs are trivial, so they are not cached
+  if ( iovs && !content_id.empty() && own_scope == path ) m_boundaries_cache->insert( content_id, out );
+  narrow_scope( scope, own_scope );
+  return out;
+}
+
+details::IOVTree CondDB::collect_iov_tree( const std::string& object_id, std::size_t n_threads ) const {
+  details::IOVTree tree;
+
+  // entries to look up, and number of entries queued or being looked up
+  std::vector<std::string> queue{object_id};
+  std::size_t              pending = 1;
+  std::exception_ptr       error;
+  std::mutex               mutex;
+  std::condition_variable  cv;
+  tree.nodes.emplace( object_id, details::IOVTree::node{} );
+
+  auto worker = [&]() {
+    std::unique_lock<std::mutex> lock( mutex );
+    while ( true ) {
+      cv.wait( lock, [&]() { return !queue.empty() || pending == 0; } );
+      if ( queue.empty() ) return; // all done
+      const auto id = std::move( queue.back() );
+      queue.pop_back();
+      lock.unlock();
+
+      details::IOVTree::node   node;
+      std::vector<std::string> children;
+      try {
+        node.content_id = m_impl->content_id( id.c_str() );
+        if ( !node.content_id.empty() ) node.cached = m_boundaries_cache->find( node.content_id );
+        if ( !node.cached ) node.iovs = m_impl->find_iovs( id.c_str() );
+        if ( node.iovs ) {
+          for ( std::size_t i = 0; i < node.iovs->size(); ++i ) {
+            if ( node.iovs->iov( i ).valid() )
+              children.push_back( normalize( child_iovs_id( id, node.iovs->key( i ) ) ) );
+          }
+        }
+      } catch ( ... ) {
+        lock.lock();
+        if ( !error ) error = std::current_exception();
+        queue.clear(); // stop all workers
+        pending = 0;
+        cv.notify_all();
+        return;
+      }
+
+      lock.lock();
+      if ( error ) return;
+      for ( auto& child : children ) {
+        if ( tree.nodes.emplace( child, details::IOVTree::node{} ).second ) {
+          queue.push_back( std::move( child ) );
+          ++pending;
+        }
+      }
+      tree.nodes[id] = std::move( node );
+      if ( --pending == 0 || !children.empty() ) cv.notify_all();
+    }
+  };
+
+  // the amount of work is not known in advance, so the extra workers are bounded by the hardware
+  n_threads = std::clamp<std::size_t>( n_threads, 1, std::max( 1u, std::thread::hardware_concurrency() ) );
+  std::vector<std::thread> threads;
+  threads.reserve( n_threads - 1 );
+  for ( std::size_t i = 1; i < n_threads; ++i ) threads.emplace_back( worker );
+  worker();
+  for ( auto& t : threads ) t.join();
+
+  if ( error ) std::rethrow_exception( error );
+  return tree;
+}
+
+std::vector<std::string> CondDB::changed_paths( std::string_view old_tag, std::string_view new_tag,
+                                               std::string_view prefix ) const {
+  std::string root = normalize( prefix );
+  while ( !root.empty() && root.back() == '/' ) root.pop_back();
+
+  const auto old_tag_id = m_impl->resolve_tag( std::string{old_tag}.c_str() );
+  const auto new_tag_id = m_impl->resolve_tag( std::string{new_tag}.c_str() );
+  const auto changes =
+      m_impl->diff( format_obj_id( old_tag_id, root ).c_str(), format_obj_id( new_tag_id, root ).c_str() );
+
+  // map the changed entries to the conditions containing them
+  std::set<std::string>                 candidates;
+  std::unordered_map<std::string, bool> has_iovs;
+  for ( const auto& path : changes ) {
+    // an entry in a directory with an IOVs file belongs to the outermost one
+    bool found = false;
+    for ( auto pos = path.find( '/' ); !found && pos != path.npos; pos = path.find( '/', pos + 1 ) ) {
+      const auto dir  = path.substr( 0, pos );
+      auto [it, todo] = has_iovs.emplace( dir, false );
+      if ( todo ) {
+        it->second = m_impl->exists( format_obj_id( old_tag_id, dir + "/IOVs" ).c_str() ) ||
+                     m_impl->exists( format_obj_id( new_tag_id, dir + "/IOVs" ).c_str() );
+      }
+      if ( ( found = it->second ) ) candidates.insert( dir );
+    }
+    if ( !found ) {
+      collect_conditions( format_obj_id( old_tag_id, path ), candidates );
+      collect_conditions( format_obj_id( new_tag_id, path ), candidates );
+    }
+  }
+
+  // report only the conditions that resolve differently
+  std::vector<std::string> out;
+  for ( const auto& path : candidates ) {
+    const auto old_timeline = iov_timeline( old_tag_id, path );
+    const auto new_timeline = iov_timeline( new_tag_id, path );
+    const bool same         = std::equal(
+        old_timeline.begin(), old_timeline.end(), new_timeline.begin(), new_timeline.end(),
+        []( const timeline_entry& a, const timeline_entry& b ) {
+          return a.iov.since == b.iov.since && a.iov.until == b.iov.until && a.content_id == b.content_id;
+        } );
+    if ( !same ) out.push_back( path );
   }
+  return out;
+}
+
+void CondDB::collect_conditions( const std::string& object_id, std::set<std::string>& out ) const {
+  if ( !m_impl->exists( object_id.c_str() ) ) return;
+  const std::string path{details::DBImpl::strip_tag( object_id )};
+  auto              data = m_impl->lookup( object_id.c_str() );
+  if ( data.index() == 0 || std::get<1>( data ).iovs ) {
+    out.insert( path );
+    return;
+  }
+  const auto& content = std::get<1>( data ).content;
+  const auto  prefix  = details::DBImpl::child_prefix( object_id );
+  for ( const auto& file : content.files ) out.insert( details::DBImpl::child_prefix( path ) + file );
+  for ( const auto& dir : content.dirs ) collect_conditions( prefix + dir, out );
+}
+
+std::tuple<std::string, CondDB::IOV> CondDB::locate( const Key& key, const IOV& bounds ) const {
+  std::string object_id = format_obj_id( key );
+  IOV         iov       = bounds;
+  while ( const auto iovs = m_impl->find_iovs( object_id.c_str() ) ) {
+    const auto [id, child_iov] = iovs->find( key.time_point, iov, m_reduce_iovs );
+    if ( UNLIKELY( !child_iov.valid() ) ) return {std::string{}, child_iov};
+    object_id = normalize( child_iovs_id( object_id, id ) );
+    iov       = child_iov;
+  }
+  return {object_id, iov};
+}
+
+void CondDB::iov_timeline_accumulate( const std::string& object_id, const IOV& limits,
+                                      std::vector<timeline_entry>& acc ) const {
+  if ( const auto iovs = m_impl->find_iovs( object_id.c_str() ) ) {
+    for ( std::size_t i = 0; i < iovs->size(); ++i ) {
+      const auto iov = iovs->iov( i );
+      if ( limits.overlaps( iov ) ) {
+        const auto child_id = normalize( child_iovs_id( object_id, iovs->key( i ) ) );
+        iov_timeline_accumulate( child_id, limits.intersect( iov ), acc );
+      }
+    }
+  } else {
+    acc.push_back( {limits, object_id, {}, {}} );
+  }
+}
+
+std::vector<CondDB::timeline_entry> CondDB::iov_timeline( std::string_view tag, std::string_view path,
+                                                          const IOV& bounds, bool with_payloads ) const {
+  std::vector<timeline_entry> out;
+
+  const auto object_id = format_obj_id( tag, path );
+
+  if ( UNLIKELY( !bounds.valid() || !m_impl->exists( object_id.c_str() ) ) ) return out;
+
+  iov_timeline_accumulate( object_id, bounds, out );
+
+  // look up each object only once
+  std::unordered_map<std::string, std::string> content_ids;
+  std::unordered_map<std::string, Payload>     payloads;
+  for ( auto& entry : out ) {
+    auto& content_id = content_ids[entry.object_id];
+    if ( content_id.empty() ) content_id = content_or_object_id( *m_impl, entry.object_id );
+    entry.content_id = content_id;
+    if ( with_payloads ) {
+      auto payload = payloads.find( content_id );
+      if ( payload == payloads.end() ) {
+        const Key  key{std::string{tag}, std::string{details::DBImpl::strip_tag( entry.object_id )}, entry.iov.since};
+        resolution how;
+        payload = payloads.emplace( content_id, std::get<0>( resolve( key, entry.iov, how ) ) ).first;
+      }
+      entry.payload = payload->second;
+    }
+  }
+
+  return out;
 }
 
 std::vector<CondDB::time_point_t> CondDB::iov_boundaries( std::string_view tag, std::string_view path,
-                                                          const IOV& boundaries ) const {
+                                                          const IOV& boundaries, std::size_t n_threads ) const {
   std::vector<CondDB::time_point_t> out;
 
   const auto object_id = format_obj_id( tag, path );
 
   if ( UNLIKELY( !boundaries.valid() || !m_impl->exists( object_id.c_str() ) ) ) return out;
 
-  std::vector<std::pair<CondDB::IOV, std::string>> tmp;
-  iov_boundaries_accumulate( object_id, boundaries, tmp );
-  std::transform( begin( tmp ), end( tmp ), back_inserter( out ),
-                  []( const auto& entry ) { return entry.first.since; } );
+  std::string scope{details::DBImpl::strip_tag( object_id )};
+  if ( n_threads > 1 ) {
+    // look up the entries in parallel, then merge them as in the serial case
+    const auto tree = collect_iov_tree( object_id, n_threads );
+    flat_iovs( object_id, scope, &tree )->boundaries( boundaries, out );
+  } else {
+    flat_iovs( object_id, scope )->boundaries( boundaries, out );
+  }
 
   return out;
 }
@@ -0,0 +1,120 @@
+#ifndef IOVBOUNDARIESCACHE_H
+#define IOVBOUNDARIESCACHE_H
+/*****************************************************************************\
+* (c) Copyright 2018 CERN for the benefit of the LHCb Collaboration           *
+*                                                                             *
+* This software is distributed under the terms of the Apache version 2        *
+* licence, copied verbatim in the file "COPYING".                             *
+*                                                                             *
+* In applying this licence, CERN does not waive the privileges and immunities *
+* granted to it by virtue of its status as an Intergovernmental Organization  *
+* or submit itself to any jurisdiction.                                       *
+\*****************************************************************************/
+
+#include <GitCondDB.h>
+
+#include "iov_helpers.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace GitCondDB {
+  inline namespace v1 {
+    namespace details {
+      /// Flattened IOVs of an entry of the database, i.e. the validity of each of the payloads
+      /// reachable through the (nested) IOVs files, in the order of the IOVs files.
+      struct IOVBoundaries {
+        using IOV          = CondDB::IOV;
+        using time_point_t = CondDB::time_point_t;
+
+        std::vector<IOV> iovs;
+        /// True if the IOVs do not overlap and are in increasing order.
+        bool sorted = true;
+
+        /// Append the IOVs of child, restricted to iov.
+        void append( const IOVBoundaries& child, const IOV& iov ) {
+          for ( const auto& other : child.iovs ) {
+            if ( !other.overlaps( iov ) ) continue;
+            const auto tmp = other.intersect( iov );
+            if ( !iovs.empty() && tmp.since < iovs.back().until ) sorted = false;
+            iovs.push_back( tmp );
+          }
+        }
+
+        /// Append to out the beginning of the IOVs within limits (as returned by CondDB::iov_boundaries).
+        void boundaries( const IOV& limits, std::vector<time_point_t>& out ) const {
+          auto first = begin( iovs );
+          auto last  = end( iovs );
+          if ( sorted ) {
+            first = std::partition_point( first, last,
+                                          [&limits]( const IOV& iov ) { return iov.until <= limits.since; } );
+          }
+          for ( ; first != last; ++first ) {
+            if ( first->overlaps( limits ) ) {
+              out.push_back( std::max( first->since, limits.since ) );
+            } else if ( sorted && first->since >= limits.until ) {
+              break;
+            }
+          }
+        }
+      };
+
+      /// What is needed to flatten the IOVs of the entries of a tree, collected in advance by
+      /// several threads (see CondDB::iov_boundaries), indexed by (normalized) object id.
+      struct IOVTree {
+        struct node {
+          std::string                              content_id;
+          std::shared_ptr<const IOVBoundaries>     cached;
+          std::shared_ptr<const Helpers::IOVIndex> iovs;
+        };
+        std::unordered_map<std::string, node> nodes;
+      };
+
+      /// Cache of the flattened IOVs of the entries of the database, indexed by content id
+      /// (see DBImpl::content_id).
+      ///
+      /// When the total number of cached IOVs exceeds the limit, the cache is emptied.
+      class IOVBoundariesCache {
+      public:
+        explicit IOVBoundariesCache( std::size_t max_iovs = 1 << 20 ) : m_max_iovs{max_iovs} {}
+
+        std::shared_ptr<const IOVBoundaries> find( const std::string& id ) const {
+          std::lock_guard<std::mutex> guard( m_mutex );
+          if ( auto it = m_entries.find( id ); it != m_entries.end() ) return it->second;
+          return nullptr;
+        }
+
+        void insert( std::string id, std::shared_ptr<const IOVBoundaries> entry ) {
+          std::lock_guard<std::mutex> guard( m_mutex );
+          if ( m_size + entry->iovs.size() > m_max_iovs ) clear_unlocked();
+          if ( entry->iovs.size() > m_max_iovs ) return;
+          const auto size = entry->iovs.size();
+          if ( m_entries.emplace( std::move( id ), std::move( entry ) ).second ) m_size += size;
+        }
+
+        void clear() {
+          std::lock_guard<std::mutex> guard( m_mutex );
+          clear_unlocked();
+        }
+
+      private:
+        void clear_unlocked() {
+          m_entries.clear();
+          m_size = 0;
+        }
+
+        std::size_t m_max_iovs;
+        std::size_t m_size = 0;
+
+        std::unordered_map<std::string, std::shared_ptr<const IOVBoundaries>> m_entries;
+        mutable std::mutex                                                     m_mutex;
+      };
+    } // namespace details
+  }   // namespace v1
+} // namespace GitCondDB
+
+#endif // IOVBOUNDARIESCACHE_H
@@ -0,0 +1,325 @@
+#ifndef JSONTREE_H
+#define JSONTREE_H
+/*****************************************************************************\
+* (c) Copyright 2018 CERN for the benefit of the LHCb Collaboration           *
+*                                                                             *
+* This software is distributed under the terms of the Apache version 2        *
+* licence, copied verbatim in the file "COPYING".                             *
+*                                                                             *
+* In applying this licence, CERN does not waive the privileges and immunities *
+* granted to it by virtue of its status as an Intergovernmental Organization  *
+* or submit itself to any jurisdiction.                                       *
+\*****************************************************************************/
+
+#include "common.h"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace GitCondDB {
+  inline namespace v1 {
+    namespace details {
+      /// Compact read-only representation of a JSON document used as a conditions database,
+      /// filled directly by the (SAX) JSON parser, without building the nlohmann::json DOM.
+      ///
+      /// The string values are stored in one contiguous buffer, the keys are interned, and the
+      /// entries are small fixed size records pointing to their parent, indexed by the hash of
+      /// their path in an open addressing table, so that no memory is allocated per entry.
+      ///
+      /// Only objects and strings are meaningful for the database: other values are recorded
+      /// (to be able to report them as invalid), but the content of arrays is ignored, as well
+      /// as null values.
+      class JSONTree {
+      public:
+        enum class node_type : std::uint32_t { string, object, other };
+
+        struct node {
+          /// Offset of a string in the values buffer, or index of the first child of an object.
+          std::uint64_t first;
+          /// Length of a string, or number of children of an object.
+          std::uint32_t size;
+          std::uint32_t key;
+          std::uint32_t parent;
+          node_type     type;
+        };
+
+        /// Parse a JSON document from memory.
+        static std::shared_ptr<const JSONTree> parse( std::string_view data ) {
+          std::shared_ptr<JSONTree> tree{new JSONTree};
+          // the string values cannot be longer than the document
+          tree->m_values.reserve( data.size() );
+          builder b{*tree};
+          nlohmann::json::sax_parse( data, &b );
+          return tree;
+        }
+
+        /// Parse a JSON document from a stream.
+        static std::shared_ptr<const JSONTree> parse( std::istream& stream ) {
+          std::shared_ptr<JSONTree> tree{new JSONTree};
+          if ( const auto start = stream.tellg(); start != -1 && stream.seekg( 0, std::ios::end ) ) {
+            tree->m_values.reserve( static_cast<std::size_t>( stream.tellg() - start ) );
+            stream.seekg( start );
+          }
+          builder b{*tree};
+          nlohmann::json::sax_parse( stream, &b );
+          return tree;
+        }
+
+        /// Return the entry with the given path (without leading '/', the root being ""),
+        /// or nullptr if there is no such entry.
+        const node* find( std::string_view path ) const {
+          if ( path.empty() ) return m_nodes.empty() ? nullptr : &m_nodes.front();
+          if ( m_slots.empty() ) return nullptr;
+          const auto h    = hash( path );
+          const auto mask = m_slots.size() - 1;
+          for ( auto i = h & mask; m_slots[i].node != npos; i = ( i + 1 ) & mask ) {
+            if ( m_slots[i].hash == h && matches( m_slots[i].node, path ) ) return &m_nodes[m_slots[i].node];
+          }
+          return nullptr;
+        }
+
+        /// Content of a string entry.
+        std::string_view value( const node& n ) const { return std::string_view{m_values}.substr( n.first, n.size ); }
+
+        std::string_view key( const node& n ) const { return ( n.key != npos ) ? key( n.key ) : std::string_view{}; }
+
+        /// Entries of an object, sorted by key.
+        template <typename F>
+        void for_each_child( const node& n, F&& f ) const {
+          if ( n.type != node_type::object ) return;
+          for ( auto i = n.first; i < n.first + n.size; ++i ) f( m_nodes[m_children[i]] );
+        }
+
+        /// Approximate memory used by the tree, in bytes.
+        std::size_t memory_usage() const {
+          return m_values.capacity() + m_key_data.capacity() + m_keys.capacity() * sizeof( key_ref ) +
+                 m_nodes.capacity() * sizeof( node ) + m_children.capacity() * sizeof( std::uint32_t ) +
+                 m_slots.capacity() * sizeof( slot );
+        }
+
+        // the tree is only used through shared pointers
+        JSONTree( const JSONTree& ) = delete;
+        JSONTree& operator=( const JSONTree& ) = delete;
+
+      private:
+        static constexpr std::uint32_t npos = std::numeric_limits<std::uint32_t>::max();
+
+        struct key_ref {
+          std::uint64_t offset;
+          std::uint64_t size;
+        };
+
+        struct slot {
+          std::uint32_t hash;
+          std::uint32_t node;
+        };
+
+        JSONTree() = default;
+
+        static std::uint32_t hash( std::string_view path ) {
+          return static_cast<std::uint32_t>( std::hash<std::string_view>{}( path ) );
+        }
+
+        std::string_view key( std::uint32_t id ) const {
+          return std::string_view{m_key_data}.substr( m_keys[id].offset, m_keys[id].size );
+        }
+
+        /// Check if the path of an entry is the given one, walking up its parents.
+        bool matches( std::uint32_t n, std::string_view path ) const {
+          while ( true ) {
+            const auto pos = path.find_last_of( '/' );
+            if ( key( m_nodes[n] ) != path.substr( pos + 1 ) ) return false;
+            n = m_nodes[n].parent;
+            if ( n == npos ) return false; // removed entry (see builder::index)
+            if ( pos == path.npos ) return n == 0;
+            path.remove_suffix( path.size() - pos );
+          }
+        }
+
+        /// SAX handler for nlohmann::json::sax_parse filling a JSONTree.
+        class builder {
+          using json = nlohmann::json;
+
+        public:
+          builder( JSONTree& tree ) : m_tree{tree} {}
+
+          bool null() { return true; }
+          bool boolean( bool ) { return add( node_type::other ); }
+          bool number_integer( json::number_integer_t ) { return add( node_type::other ); }
+          bool number_unsigned( json::number_unsigned_t ) { return add( node_type::other ); }
+          bool number_float( json::number_float_t, const json::string_t& ) { return add( node_type::other ); }
+          template <typename T>
+          bool binary( T& ) {
+            return add( node_type::other );
+          }
+
+          bool string( json::string_t& value ) {
+            if ( m_skip ) return true;
+            if ( UNLIKELY( value.size() >= npos ) ) throw std::runtime_error{"invalid JSON: string too long"};
+            add( node_type::string, m_tree.m_values.size(), static_cast<std::uint32_t>( value.size() ) );
+            m_tree.m_values += value;
+            return true;
+          }
+
+          bool start_object( std::size_t = 0 ) {
+            if ( m_skip ) {
+              ++m_skip;
+              return true;
+            }
+            add( node_type::object );
+            m_stack.push_back( {static_cast<std::uint32_t>( m_tree.m_nodes.size() - 1 ), m_pending.size(),
+                                m_path.size()} );
+            return true;
+          }
+
+          bool key( json::string_t& name ) {
+            if ( m_skip ) return true;
+            m_path.resize( m_stack.back().path_size );
+            if ( !m_path.empty() ) m_path += '/';
+            m_path += name;
+            m_key = intern( name );
+            return true;
+          }
+
+          bool end_object() {
+            if ( m_skip ) {
+              --m_skip;
+              return true;
+            }
+            const auto frame = m_stack.back();
+            m_stack.pop_back();
+
+            auto& tree  = m_tree;
+            auto  first = m_pending.begin() + frame.first_child;
+            // drop the entries replaced by duplicated keys and sort the others by key
+            auto last = std::remove_if( first, m_pending.end(),
+                                        [&tree]( std::uint32_t i ) { return tree.m_nodes[i].parent == npos; } );
+            std::sort( first, last, [&tree]( std::uint32_t a, std::uint32_t b ) {
+              return tree.key( tree.m_nodes[a] ) < tree.key( tree.m_nodes[b] );
+            } );
+            auto& n = tree.m_nodes[frame.node];
+            n.first = tree.m_children.size();
+            n.size  = static_cast<std::uint32_t>( last - first );
+            tree.m_children.insert( tree.m_children.end(), first, last );
+            m_pending.resize( frame.first_child );
+            return true;
+          }
+
+          bool start_array( std::size_t = 0 ) {
+            if ( !m_skip ) add( node_type::other );
+            ++m_skip;
+            return true;
+          }
+
+          bool end_array() {
+            --m_skip;
+            return true;
+          }
+
+          bool parse_error( std::size_t, const std::string&, const json::exception& err ) {
+            throw std::runtime_error{std::string{"invalid JSON: "} + err.what()};
+          }
+
+        private:
+          std::uint32_t intern( const std::string& name ) {
+            auto& tree            = m_tree;
+            const auto [it, is_new] = m_key_ids.emplace( name, static_cast<std::uint32_t>( tree.m_keys.size() ) );
+            if ( is_new ) {
+              tree.m_keys.push_back( {tree.m_key_data.size(), name.size()} );
+              tree.m_key_data += name;
+            }
+            return it->second;
+          }
+
+          /// Add an entry for the current key (if not within an array).
+          bool add( node_type type, std::uint64_t first = 0, std::uint32_t size = 0 ) {
+            if ( m_skip ) return true;
+            auto&      tree = m_tree;
+            const auto id   = static_cast<std::uint32_t>( tree.m_nodes.size() );
+            if ( UNLIKELY( id == npos ) ) throw std::runtime_error{"invalid JSON: too many entries"};
+            if ( m_stack.empty() ) {
+              tree.m_nodes.push_back( {first, size, npos, npos, type} );
+            } else {
+              tree.m_nodes.push_back( {first, size, m_key, m_stack.back().node, type} );
+              m_pending.push_back( id );
+              index( id );
+            }
+            return true;
+          }
+
+          /// Add an entry to the hash table (grown to keep it at most half full).
+          void index( std::uint32_t id ) {
+            auto& slots = m_tree.m_slots;
+            if ( 2 * ( m_indexed + 1 ) > slots.size() ) {
+              std::vector<slot> old( std::max<std::size_t>( 2 * slots.size(), 1024 ), {0, npos} );
+              old.swap( slots );
+              for ( const auto& s : old ) {
+                if ( s.node != npos ) insert( s );
+              }
+            }
+            if ( insert( {hash( m_path ), id} ) ) ++m_indexed;
+          }
+
+          /// Insert an entry in the hash table, returning false if it replaced an entry with the same path.
+          bool insert( slot entry ) {
+            auto&       tree  = m_tree;
+            auto&       slots = tree.m_slots;
+            const auto  mask  = slots.size() - 1;
+            const auto& n     = tree.m_nodes[entry.node];
+            for ( auto i = entry.hash & mask;; i = ( i + 1 ) & mask ) {
+              if ( slots[i].node == npos ) {
+                slots[i] = entry;
+                return true;
+              }
+              auto& other = tree.m_nodes[slots[i].node];
+              if ( slots[i].hash == entry.hash && other.parent == n.parent && other.key == n.key ) {
+                // duplicated key: the last one wins (as for nlohmann::json) and the previous one
+                // (with all its content) is detached from the tree
+                other.parent  = npos;
+                slots[i].node = entry.node;
+                return false;
+              }
+            }
+          }
+
+          struct frame {
+            std::uint32_t node;
+            std::size_t   first_child;
+            std::size_t   path_size;
+          };
+
+          JSONTree&                  m_tree;
+          std::string                m_path;
+          std::uint32_t              m_key = npos;
+          std::vector<frame>         m_stack;
+          std::vector<std::uint32_t> m_pending;
+          std::size_t                m_indexed = 0;
+          /// Nesting level within arrays (their content is ignored).
+          std::size_t m_skip = 0;
+
+          std::unordered_map<std::string, std::uint32_t> m_key_ids;
+        };
+
+        std::string                m_values;
+        std::string                m_key_data;
+        std::vector<key_ref>       m_keys;
+        std::vector<node>          m_nodes;
+        std::vector<std::uint32_t> m_children;
+        std::vector<slot>          m_slots;
+      };
+    } // namespace details
+  }   // namespace v1
+} // namespace GitCondDB
+
+#endif // JSONTREE_H
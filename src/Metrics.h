@@ -0,0 +1,120 @@
+#ifndef METRICS_H
+#define METRICS_H
+/*****************************************************************************\
+* (c) Copyright 2018 CERN for the benefit of the LHCb Collaboration           *
+*                                                                             *
+* This software is distributed under the terms of the Apache version 2        *
+* licence, copied verbatim in the file "COPYING".                             *
+*                                                                             *
+* In applying this licence, CERN does not waive the privileges and immunities *
+* granted to it by virtue of its status as an Intergovernmental Organization  *
+* or submit itself to any jurisdiction.                                       *
+\*****************************************************************************/
+
+#include <GitCondDB.h>
+
+#include "common.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+
+namespace GitCondDB {
+  inline namespace v1 {
+    namespace details {
+      /// Counters and latency histograms of the operations of a backend.
+      ///
+      /// All the counters are independent atomics updated with relaxed ordering, so
+      /// recording never blocks, but a snapshot taken while operations are recorded
+      /// may be slightly inconsistent (e.g. count not matching the histogram).
+      class Metrics {
+      public:
+        using operation = CondDB::operation;
+        using clock     = std::chrono::steady_clock;
+
+        /// Record the time spent between construction and destruction (if the metrics are enabled).
+        class timer {
+        public:
+          timer( Metrics& metrics, operation op ) : m_metrics{metrics.enabled() ? &metrics : nullptr}, m_op{op} {
+            if ( UNLIKELY( m_metrics != nullptr ) ) m_start = clock::now();
+          }
+          ~timer() {
+            if ( UNLIKELY( m_metrics != nullptr ) ) m_metrics->record( m_op, clock::now() - m_start );
+          }
+          timer( const timer& ) = delete;
+          timer& operator=( const timer& ) = delete;
+
+        private:
+          Metrics*          m_metrics;
+          operation         m_op;
+          clock::time_point m_start{};
+        };
+
+        bool enabled() const { return m_enabled.load( std::memory_order_relaxed ); }
+        void enable( bool value ) { m_enabled.store( value, std::memory_order_relaxed ); }
+
+        void record( operation op, clock::duration duration ) {
+          const std::uint64_t ns =
+              std::max<std::int64_t>( 0, std::chrono::duration_cast<std::chrono::nanoseconds>( duration ).count() );
+
+          auto& counters = m_counters[static_cast<std::size_t>( op )];
+          counters.count.fetch_add( 1, std::memory_order_relaxed );
+          counters.total_ns.fetch_add( ns, std::memory_order_relaxed );
+          auto max = counters.max_ns.load( std::memory_order_relaxed );
+          while ( max < ns && !counters.max_ns.compare_exchange_weak( max, ns, std::memory_order_relaxed ) ) {}
+          counters.histogram[bin( ns )].fetch_add( 1, std::memory_order_relaxed );
+        }
+
+        CondDB::metrics_stats snapshot( std::string_view backend ) const {
+          CondDB::metrics_stats out;
+          out.backend = backend;
+          for ( std::size_t i = 0; i < CondDB::n_operations; ++i ) {
+            const auto& counters = m_counters[i];
+            auto&       stats    = out.operations[i];
+            stats.count          = counters.count.load( std::memory_order_relaxed );
+            stats.total_ns       = counters.total_ns.load( std::memory_order_relaxed );
+            stats.max_ns         = counters.max_ns.load( std::memory_order_relaxed );
+            for ( std::size_t b = 0; b < n_bins; ++b )
+              stats.latency_histogram[b] = counters.histogram[b].load( std::memory_order_relaxed );
+          }
+          return out;
+        }
+
+        void reset() {
+          for ( auto& counters : m_counters ) {
+            counters.count.store( 0, std::memory_order_relaxed );
+            counters.total_ns.store( 0, std::memory_order_relaxed );
+            counters.max_ns.store( 0, std::memory_order_relaxed );
+            for ( auto& b : counters.histogram ) b.store( 0, std::memory_order_relaxed );
+          }
+        }
+
+      private:
+        static constexpr std::size_t n_bins = CondDB::operation_stats::n_bins;
+
+        /// Index of the highest bit set, i.e. floor(log2(ns)), capped to the last bin.
+        static std::size_t bin( std::uint64_t ns ) {
+          std::size_t b = 0;
+          while ( ns >>= 1 ) ++b;
+          return std::min( b, n_bins - 1 );
+        }
+
+        /// Counters of one operation (on their own cache lines, to limit contention).
+        struct alignas( 64 ) counters_t {
+          std::atomic<std::uint64_t>                     count{0};
+          std::atomic<std::uint64_t>                     total_ns{0};
+          std::atomic<std::uint64_t>                     max_ns{0};
+          std::array<std::atomic<std::uint64_t>, n_bins> histogram{};
+        };
+
+        std::atomic<bool>                            m_enabled{false};
+        std::array<counters_t, CondDB::n_operations> m_counters;
+      };
+    } // namespace details
+  }   // namespace v1
+} // namespace GitCondDB
+
+#endif // METRICS_H
@@ -0,0 +1,194 @@
+#ifndef PAYLOADCACHE_H
+#define PAYLOADCACHE_H
+/*****************************************************************************\
+* (c) Copyright 2018 CERN for the benefit of the LHCb Collaboration           *
+*                                                                             *
+* This software is distributed under the terms of the Apache version 2        *
+* licence, copied verbatim in the file "COPYING".                             *
+*                                                                             *
+* In applying this licence, CERN does not waive the privileges and immunities *
+* granted to it by virtue of its status as an Intergovernmental Organization  *
+* or submit itself to any jurisdiction.                                       *
+\*****************************************************************************/
+
+#include <GitCondDB.h>
+
+#include "common.h"
+
+#include <algorithm>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+namespace GitCondDB {
+  inline namespace v1 {
+    namespace details {
+      /// Size bounded (entries and bytes) LRU cache of resolved payloads.
+      ///
+      /// Entries are indexed by tag and path of the requested key and are
+      /// valid for all the time points in the IOV they were resolved for.
+      ///
+      /// Each entry records the scope of the resolution, i.e. the directory containing all the
+      /// entries of the database used to resolve it, so that it can be invalidated when any of
+      /// them changes.
+      class PayloadCache {
+      public:
+        using IOV          = CondDB::IOV;
+        using Payload      = CondDB::Payload;
+        using Key          = CondDB::Key;
+        using time_point_t = CondDB::time_point_t;
+
+        PayloadCache( std::size_t max_entries, std::size_t max_bytes )
+            : m_max_entries{max_entries}, m_max_bytes{max_bytes} {}
+
+        /// Look for a payload valid for the requested key, and return it as CondDB::get would do
+        /// with the given bounds.
+        std::optional<std::tuple<Payload, IOV>> find( const Key& key, const IOV& bounds ) {
+          std::lock_guard<std::mutex> guard( m_mutex );
+
+          auto [first, last] = m_index.equal_range( make_id( key ) );
+          for ( ; first != last; ++first ) {
+            auto entry = first->second;
+            if ( entry->iov.contains( key.time_point ) ) {
+              ++m_stats.hits;
+              // move the entry to the front of the LRU list
+              m_lru.splice( m_lru.begin(), m_lru, entry );
+              return apply( *entry, key.time_point, bounds );
+            }
+          }
+          ++m_stats.misses;
+          return std::nullopt;
+        }
+
+        /// Add a payload valid in iov to the cache.
+        ///
+        /// If from_iovs is false, the payload was not found through an IOVs file, so it is
+        /// valid for any time point and it is reported with the bounds requested at lookup.
+        ///
+        /// The payload is not added if the cache was invalidated after generation() returned
+        /// the given value, since it may have been resolved from outdated data.
+        void insert( const Key& key, Payload payload, const IOV& iov, bool from_iovs, std::string scope,
+                     std::size_t generation ) {
+          std::lock_guard<std::mutex> guard( m_mutex );
+          if ( UNLIKELY( generation != m_generation ) ) return;
+
+          auto id = make_id( key );
+
+          const std::size_t size = id.size() + payload.size();
+          if ( UNLIKELY( size > m_max_bytes || m_max_entries == 0 ) ) return;
+
+          m_lru.push_front( Entry{std::move( id ), key.tag.size(), std::move( scope ), from_iovs ? iov : IOV{},
+                                  std::move( payload ), from_iovs} );
+          m_index.emplace( m_lru.front().id, m_lru.begin() );
+          m_stats.bytes += size;
+          ++m_stats.entries;
+
+          while ( m_stats.entries > m_max_entries || m_stats.bytes > m_max_bytes ) {
+            evict_last();
+            ++m_stats.evictions;
+          }
+        }
+
+        void clear() {
+          std::lock_guard<std::mutex> guard( m_mutex );
+          ++m_generation;
+          m_index.clear();
+          m_lru.clear();
+          m_stats.entries = m_stats.bytes = 0;
+        }
+
+        /// Drop the entries of a tag whose resolution may depend on the given paths (or on
+        /// the content of the given directories), returning the number of dropped entries.
+        std::size_t invalidate( std::string_view tag, const std::vector<std::string>& paths ) {
+          std::lock_guard<std::mutex> guard( m_mutex );
+          ++m_generation;
+          std::size_t count = 0;
+          for ( auto entry = m_lru.begin(); entry != m_lru.end(); ) {
+            const auto& scope = entry->scope;
+            if ( entry->tag() == tag && std::any_of( begin( paths ), end( paths ), [&scope]( std::string_view p ) {
+                   return contains( scope, p ) || contains( p, scope );
+                 } ) ) {
+              entry = erase( entry );
+              ++count;
+            } else {
+              ++entry;
+            }
+          }
+          return count;
+        }
+
+        /// Counter of invalidations (see insert).
+        std::size_t generation() const {
+          std::lock_guard<std::mutex> guard( m_mutex );
+          return m_generation;
+        }
+
+        CondDB::cache_stats stats() const {
+          std::lock_guard<std::mutex> guard( m_mutex );
+          return m_stats;
+        }
+
+      private:
+        struct Entry {
+          std::string id;
+          std::size_t tag_size;
+          std::string scope;
+          IOV         iov;
+          Payload     payload;
+          bool        from_iovs;
+
+          std::size_t      size() const { return id.size() + payload.size(); }
+          std::string_view tag() const { return std::string_view{id}.substr( 0, tag_size ); }
+        };
+        using lru_t = std::list<Entry>;
+
+        static std::string make_id( const Key& key ) { return key.tag + ':' + key.path; }
+
+        /// Tell if path is dir or an entry in dir (at any depth).
+        static bool contains( std::string_view dir, std::string_view path ) {
+          return dir.empty() || ( path.substr( 0, dir.size() ) == dir &&
+                                  ( path.size() == dir.size() || path[dir.size()] == '/' ) );
+        }
+
+        /// Reproduce the effect of the bounds on the output of CondDB::get.
+        static std::tuple<Payload, IOV> apply( const Entry& entry, time_point_t t, const IOV& bounds ) {
+          if ( !entry.from_iovs ) return {entry.payload, bounds};
+          if ( UNLIKELY( !bounds.contains( t ) ) ) return {Payload{}, IOV{0, 0}};
+          return {entry.payload, entry.iov.intersect( bounds )};
+        }
+
+        void evict_last() { erase( std::prev( m_lru.end() ) ); }
+
+        lru_t::iterator erase( lru_t::iterator entry ) {
+          auto [first, stop] = m_index.equal_range( entry->id );
+          for ( ; first != stop; ++first ) {
+            if ( first->second == entry ) {
+              m_index.erase( first );
+              break;
+            }
+          }
+          m_stats.bytes -= entry->size();
+          --m_stats.entries;
+          return m_lru.erase( entry );
+        }
+
+        std::size_t m_max_entries;
+        std::size_t m_max_bytes;
+
+        lru_t                                                      m_lru;
+        std::unordered_multimap<std::string_view, lru_t::iterator> m_index;
+
+        CondDB::cache_stats m_stats;
+        std::size_t         m_generation = 0;
+
+        mutable std::mutex m_mutex;
+      };
+    } // namespace details
+  }   // namespace v1
+} // namespace GitCondDB
+
+#endif // PAYLOADCACHE_H
@@ -0,0 +1,128 @@
+#ifndef PAYLOADSTORE_H
+#define PAYLOADSTORE_H
+/*****************************************************************************\
+* (c) Copyright 2018 CERN for the benefit of the LHCb Collaboration           *
+*                                                                             *
+* This software is distributed under the terms of the Apache version 2        *
+* licence, copied verbatim in the file "COPYING".                             *
+*                                                                             *
+* In applying this licence, CERN does not waive the privileges and immunities *
+* granted to it by virtue of its status as an Intergovernmental Organization  *
+* or submit itself to any jurisdiction.                                       *
+\*****************************************************************************/
+
+#include <GitCondDB.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace GitCondDB {
+  inline namespace v1 {
+    namespace details {
+      /// Store of the payloads in use, indexed by content id (e.g. the blob id in Git), so that
+      /// identical payloads reached from different tags or paths share the same data.
+      ///
+      /// The store does not own the payloads: it only knows the ones still referenced by some
+      /// handle, and a payload is released as soon as its last handle is gone.
+      class PayloadStore {
+      public:
+        using Payload = CondDB::Payload;
+        using stats_t = CondDB::dedup_stats;
+
+        /// Return the payload with the given content id, calling load() only if it is not in use.
+        template <class LOADER>
+        Payload get( std::string key, LOADER&& load ) {
+          {
+            std::lock_guard<std::mutex> guard( m_mutex );
+            ++m_stats.lookups;
+            if ( auto found = find( key ) ) {
+              ++m_stats.hits;
+              m_stats.bytes_saved += found->size();
+              return *found;
+            }
+          }
+
+          // read outside of the lock, at the cost of reading the same payload twice in rare cases
+          Payload    loaded = load();
+          const auto data   = loaded.data();
+          auto       owner  = wrap( std::move( loaded ) );
+
+          std::lock_guard<std::mutex> guard( m_mutex );
+          // another thread may have read the same payload in the meantime (not a hit, as we read it too)
+          if ( auto found = find( key ) ) return *found;
+          if ( m_entries.size() >= m_sweep_size ) sweep();
+          m_entries[std::move( key )] = {owner, data};
+          return {std::move( owner ), data};
+        }
+
+        stats_t stats() const {
+          std::lock_guard<std::mutex> guard( m_mutex );
+          auto                        out = m_stats;
+          out.payloads                    = m_live->payloads;
+          out.bytes                       = m_live->bytes;
+          return out;
+        }
+
+      private:
+        struct entry {
+          std::weak_ptr<const void> owner;
+          std::string_view          data;
+        };
+
+        /// Payloads and bytes currently referenced (updated when the last handle is released,
+        /// which can happen after the destruction of the store).
+        struct live_counters {
+          std::atomic<std::size_t> payloads{0};
+          std::atomic<std::size_t> bytes{0};
+        };
+
+        /// Return the live payload for key, if any (the mutex must be held).
+        std::optional<Payload> find( const std::string& key ) {
+          const auto it = m_entries.find( key );
+          if ( it == m_entries.end() ) return std::nullopt;
+          auto owner = it->second.owner.lock();
+          if ( !owner ) return std::nullopt;
+          return Payload{std::move( owner ), it->second.data};
+        }
+
+        /// Take the ownership of a freshly read payload, to be notified of its release.
+        std::shared_ptr<const void> wrap( Payload payload ) const {
+          const auto size = payload.size();
+          ++m_live->payloads;
+          m_live->bytes += size;
+          return std::shared_ptr<const void>{new Payload( std::move( payload ) ),
+                                             [live = m_live, size]( const Payload* p ) {
+                                               delete p;
+                                               --live->payloads;
+                                               live->bytes -= size;
+                                             }};
+        }
+
+        /// Remove the entries of released payloads (the mutex must be held).
+        void sweep() {
+          for ( auto it = m_entries.begin(); it != m_entries.end(); ) {
+            it = it->second.owner.expired() ? m_entries.erase( it ) : std::next( it );
+          }
+          m_sweep_size = std::max( min_sweep_size, 2 * m_entries.size() );
+        }
+
+        static constexpr std::size_t min_sweep_size = 1024;
+
+        std::unordered_map<std::string, entry> m_entries;
+        std::size_t                            m_sweep_size = min_sweep_size;
+        stats_t                                m_stats;
+        std::shared_ptr<live_counters>         m_live = std::make_shared<live_counters>();
+        mutable std::mutex                     m_mutex;
+      };
+    } // namespace details
+  }   // namespace v1
+} // namespace GitCondDB
+
+#endif // PAYLOADSTORE_H
@@ -0,0 +1,356 @@
+#ifndef SNAPSHOTWRITER_H
+#define SNAPSHOTWRITER_H
+/*****************************************************************************\
+* (c) Copyright 2018 CERN for the benefit of the LHCb Collaboration           *
+*                                                                             *
+* This software is distributed under the terms of the Apache version 2        *
+* licence, copied verbatim in the file "COPYING".                             *
+*                                                                             *
+* In applying this licence, CERN does not waive the privileges and immunities *
+* granted to it by virtue of its status as an Intergovernmental Organization  *
+* or submit itself to any jurisdiction.                                       *
+\*****************************************************************************/
+
+#include <GitCondDB.h>
+
+#include "DBImpl.h"
+#include "iov_helpers.h"
+#include "path_helpers.h"
+#include "snapshot_format.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace GitCondDB {
+  inline namespace v1 {
+    namespace details {
+      /// Compile the content of a tag of a database in a snapshot file (see snapshot_format.h).
+      ///
+      /// The snapshot can be restricted to a range of time points: in that case it contains only the
+      /// entries needed to answer the requests for time points within the range, i.e.
+      ///  - the files and directories not in a directory with an IOVs file,
+      ///  - the files and directories referenced by the entries of the IOVs files overlapping the range
+      ///    (following nested IOVs files),
+      ///  - the IOVs files, reduced to the entries overlapping the range (plus the following one, which
+      ///    gives the end of validity of the last one).
+      class SnapshotWriter {
+      public:
+        using Payload = CondDB::Payload;
+        using IOV     = CondDB::IOV;
+
+        /// Read the content of the tag valid in the given range.
+        SnapshotWriter( const DBImpl& db, std::string_view tag, const IOV& range = {} )
+            : m_db{db}, m_root{db.resolve_tag( std::string{tag}.c_str() ) + ':'}, m_range{range} {
+          m_tag = add_data( Payload{std::string{tag}} );
+
+          const auto commit_time = [&db, &tag]() {
+            try {
+              return db.commit_time( std::string{tag}.c_str() );
+            } catch ( const std::runtime_error& ) { return std::chrono::system_clock::time_point::max(); }
+          }();
+          m_commit_time = ( commit_time == std::chrono::system_clock::time_point::max() )
+                              ? snapshot::no_commit_time
+                              : std::chrono::system_clock::to_time_t( commit_time );
+
+          m_restricted = range.since != IOV::min() || range.until != IOV::max();
+          if ( m_restricted ) select_tree( "" );
+
+          m_nodes.push_back( {{0, 0}, snapshot::directory, snapshot::no_iovs, 0, 0} );
+          add_directory( 0, "" );
+        }
+
+        /// Write the snapshot file.
+        ///
+        /// The data is written to a temporary file renamed to the requested name only at
+        /// the end, so that the file is never seen incomplete.
+        void write( const std::string& path ) const {
+          snapshot::header hdr{};
+          std::copy( std::begin( snapshot::magic ), std::end( snapshot::magic ), hdr.magic );
+          hdr.version     = snapshot::version;
+          hdr.byte_order  = snapshot::byte_order;
+          hdr.tag         = m_tag;
+          hdr.commit_time = m_commit_time;
+          hdr.since       = m_range.since;
+          hdr.until       = m_range.until;
+
+          std::uint64_t offset = aligned( sizeof( hdr ) );
+          auto          place  = [&offset]( std::uint64_t size, std::uint64_t bytes ) -> snapshot::section {
+            const snapshot::section s{offset, size};
+            offset = aligned( offset + bytes );
+            return s;
+          };
+          hdr.nodes      = place( m_nodes.size(), m_nodes.size() * sizeof( snapshot::node ) );
+          hdr.iov_tables = place( m_iov_tables.size(), m_iov_tables.size() * sizeof( snapshot::iov_table ) );
+          hdr.arrays     = place( m_arrays.size(), m_arrays.size() );
+          hdr.data       = place( m_data_size, m_data_size );
+
+          const std::string tmp_path = path + ".tmp";
+          {
+            std::ofstream out{tmp_path, std::ios::binary | std::ios::trunc};
+            if ( UNLIKELY( !out ) ) throw std::runtime_error{"cannot write snapshot file " + path};
+            auto write_at = [&out]( std::uint64_t pos, const void* data, std::size_t size ) {
+              static const char padding[8] = {};
+              out.write( padding, static_cast<std::streamsize>( pos - static_cast<std::uint64_t>( out.tellp() ) ) );
+              out.write( static_cast<const char*>( data ), static_cast<std::streamsize>( size ) );
+            };
+            write_at( 0, &hdr, sizeof( hdr ) );
+            write_at( hdr.nodes.offset, m_nodes.data(), m_nodes.size() * sizeof( snapshot::node ) );
+            write_at( hdr.iov_tables.offset, m_iov_tables.data(), m_iov_tables.size() * sizeof( snapshot::iov_table ) );
+            write_at( hdr.arrays.offset, m_arrays.data(), m_arrays.size() );
+            write_at( hdr.data.offset, nullptr, 0 );
+            for ( const auto& payload : m_payloads )
+              out.write( payload.data().data(), static_cast<std::streamsize>( payload.size() ) );
+            if ( UNLIKELY( !out.flush() ) ) {
+              std::remove( tmp_path.c_str() );
+              throw std::runtime_error{"cannot write snapshot file " + path};
+            }
+          }
+          fs::rename( tmp_path, path );
+        }
+
+        /// Number of entries (files and directories) in the snapshot.
+        std::size_t entries() const { return m_nodes.size(); }
+
+      private:
+        static std::uint64_t aligned( std::uint64_t offset ) { return ( offset + 7 ) & ~std::uint64_t{7}; }
+
+        static std::string child( const std::string& path, std::string_view name ) {
+          std::string out{path};
+          if ( !out.empty() ) out += '/';
+          out += name;
+          return out;
+        }
+
+        /// Validity of the entry i of a sorted table.
+        static IOV entry_iov( const Helpers::IOVIndex::Table& table, std::size_t i ) {
+          return {table.since[i], ( i + 1 < table.size ) ? table.since[i + 1] : IOV::max()};
+        }
+
+        /// Range of the entries of a table needed to answer the requests within range.
+        static std::pair<std::size_t, std::size_t> needed_entries( const Helpers::IOVIndex::Table& table,
+                                                                   const IOV& range ) {
+          if ( !table.sorted() ) return {0, table.size};
+          const auto end   = table.since + table.size;
+          const auto first = std::upper_bound( table.since, end, range.since ) - table.since;
+          const auto last  = std::lower_bound( table.since, end, range.until ) - table.since;
+          return {static_cast<std::size_t>( first ? first - 1 : 0 ),
+                  std::min( static_cast<std::size_t>( last ) + 1, table.size )};
+        }
+
+        /// Mark a path (and its parents) as needed.
+        void select( std::string_view path ) {
+          while ( m_selected.emplace( path ).second && !path.empty() ) {
+            const auto pos = path.find_last_of( '/' );
+            path           = ( pos == path.npos ) ? std::string_view{} : path.substr( 0, pos );
+          }
+        }
+
+        /// Select a directory and all its content.
+        void select_tree( const std::string& path ) {
+          select( path );
+          const auto id = m_root + path;
+          if ( const auto iovs = m_db.find_iovs( id.c_str() ) ) return select_iovs( path, path, *iovs, m_range );
+
+          auto data = m_db.get_payload( id.c_str() );
+          if ( data.index() == 0 ) return;
+          const auto& dir = std::get<1>( data );
+          for ( const auto& name : dir.files ) select( child( path, name ) );
+          for ( const auto& name : dir.dirs ) select_tree( child( path, name ) );
+        }
+
+        /// Select what is needed to resolve a key of an IOVs file (path/key, not normalized) within limits.
+        void select_key( const std::string& raw_path, const IOV& limits ) {
+          const auto path = Helpers::normalize( raw_path );
+          const auto id   = m_root + path;
+          if ( const auto iovs = m_db.find_iovs( id.c_str() ) ) {
+            select_iovs( path, raw_path, *iovs, limits );
+          } else if ( m_db.exists( id.c_str() ) ) {
+            // a key can point to a directory, in which case its content is returned
+            if ( m_db.get_payload( id.c_str() ).index() == 1 ) {
+              select_tree( path );
+            } else {
+              select( path );
+            }
+          }
+        }
+
+        /// Select the entries of an IOVs file needed for the given limits.
+        void select_iovs( const std::string& path, const std::string& raw_path, const Helpers::IOVIndex& iovs,
+                          const IOV& limits ) {
+          select( child( path, "IOVs" ) );
+          auto& done = m_iov_limits[path];
+          if ( std::any_of( begin( done ), end( done ), [&limits]( const IOV& l ) { return l.contains( limits ); } ) )
+            return;
+          done.push_back( limits );
+
+          // entries are selected for both reduced and non reduced IOVs
+          for ( const auto table : {&iovs.all(), &iovs.reduced()} ) {
+            for ( std::size_t i = 0; i < table->size; ++i ) {
+              // (with unsorted entries, we cannot tell which ones are needed)
+              const auto iov = table->sorted() ? entry_iov( *table, i ) : limits;
+              const auto key = iovs.keys()[table->key_ids[i]];
+              if ( key.empty() || !limits.overlaps( iov ) ) continue;
+              auto key_path = raw_path + '/';
+              key_path += key;
+              select_key( key_path, limits.intersect( iov ) );
+            }
+          }
+        }
+
+        /// Range to which the IOVs file of a directory has to be restricted.
+        IOV iovs_range( const std::string& path ) const {
+          if ( !m_restricted ) return {};
+          const auto limits = m_iov_limits.find( path );
+          if ( limits == m_iov_limits.end() ) return m_range;
+          IOV hull{IOV::max(), IOV::min()};
+          for ( const auto& l : limits->second ) {
+            hull.since = std::min( hull.since, l.since );
+            hull.until = std::max( hull.until, l.until );
+          }
+          return hull;
+        }
+
+        /// Fill the entries of the directory at m_nodes[index].
+        void add_directory( std::size_t index, const std::string& path ) {
+          const auto id      = m_root + path;
+          auto       content = m_db.get_payload( id.c_str() );
+          if ( UNLIKELY( content.index() != 1 ) ) throw std::runtime_error{"invalid directory " + id};
+          auto& dir = std::get<1>( content );
+
+          std::vector<std::pair<std::string, snapshot::node_type>> entries;
+          entries.reserve( dir.files.size() + dir.dirs.size() );
+          auto add_entries = [&]( std::vector<std::string>& names, snapshot::node_type type ) {
+            for ( auto& name : names ) {
+              if ( !m_restricted || m_selected.count( child( path, name ) ) )
+                entries.emplace_back( std::move( name ), type );
+            }
+          };
+          add_entries( dir.files, snapshot::file );
+          add_entries( dir.dirs, snapshot::directory );
+          std::sort( begin( entries ), end( entries ) );
+
+          const std::size_t first = m_nodes.size();
+          m_nodes[index].first    = first;
+          m_nodes[index].size     = entries.size();
+          m_nodes.resize( first + entries.size() );
+
+          for ( std::size_t i = 0; i < entries.size(); ++i ) {
+            const auto& [name, type] = entries[i];
+            const auto entry_path    = child( path, name );
+            // note: m_nodes may be reallocated by the recursion, so it must be accessed by index
+            m_nodes[first + i] = {add_data( Payload{name} ), type, snapshot::no_iovs, 0, 0};
+            if ( type == snapshot::directory ) {
+              add_directory( first + i, entry_path );
+            } else {
+              auto data = std::get<0>( m_db.get_payload( ( m_root + entry_path ).c_str() ) );
+              if ( name == "IOVs" ) {
+                const Helpers::IOVIndex iovs{data.data()};
+                const auto              range = iovs_range( path );
+                m_nodes[index].iovs           = add_iovs( iovs, range );
+                if ( m_restricted ) data = Payload{iovs_text( iovs, range )};
+              }
+              const auto ref           = add_data( data );
+              m_nodes[first + i].first = ref.offset;
+              m_nodes[first + i].size  = ref.size;
+            }
+          }
+        }
+
+        /// Add a string to the data section (if not already there).
+        snapshot::string_ref add_data( Payload data ) {
+          auto [pos, added] = m_data_offsets.emplace( data.data(), m_data_size );
+          if ( added ) {
+            m_data_size += data.size();
+            m_payloads.push_back( std::move( data ) );
+          }
+          return {pos->second, pos->first.size()};
+        }
+
+        /// Add the tables of an IOVs file (restricted to range), returning its index.
+        std::uint32_t add_iovs( const Helpers::IOVIndex& index, const IOV& range ) {
+          // the keys are renumbered, to store only those used in the selected entries
+          constexpr auto                    no_key = std::numeric_limits<std::uint32_t>::max();
+          std::vector<std::uint32_t>        key_map( index.keys().size(), no_key );
+          std::vector<snapshot::string_ref> keys;
+
+          auto table = [&]( const Helpers::IOVIndex::Table& t ) -> snapshot::table {
+            const auto [first, last] = needed_entries( t, range );
+            std::vector<std::uint32_t> key_ids;
+            key_ids.reserve( last - first );
+            for ( std::size_t i = first; i < last; ++i ) {
+              auto& id = key_map[t.key_ids[i]];
+              if ( id == no_key ) {
+                id = static_cast<std::uint32_t>( keys.size() );
+                keys.push_back( add_data( Payload{std::string{index.keys()[t.key_ids[i]]}} ) );
+              }
+              key_ids.push_back( id );
+            }
+            const auto since = add_array( t.since + first, last - first );
+            const auto ids   = add_array( key_ids.data(), key_ids.size() );
+            return {last - first, since, ids, t.sorted() ? since : add_array( t.max_since + first, last - first )};
+          };
+
+          const auto all     = table( index.all() );
+          const auto reduced = table( index.reduced() );
+          m_iov_tables.push_back( {all, reduced, add_array( keys.data(), keys.size() ), keys.size()} );
+          return static_cast<std::uint32_t>( m_iov_tables.size() - 1 );
+        }
+
+        /// Content of an IOVs file restricted to range.
+        static std::string iovs_text( const Helpers::IOVIndex& index, const IOV& range ) {
+          const auto [first, last] = needed_entries( index.all(), range );
+          std::string out;
+          for ( std::size_t i = first; i < last; ++i ) {
+            out += std::to_string( index.since( i ) );
+            out += ' ';
+            out += index.key( i );
+            out += '\n';
+          }
+          return out;
+        }
+
+        /// Append an array to the arrays section, returning its offset.
+        template <class T>
+        std::uint64_t add_array( const T* data, std::size_t size ) {
+          const std::uint64_t offset = aligned( m_arrays.size() );
+          m_arrays.resize( offset + size * sizeof( T ) );
+          if ( size ) std::memcpy( m_arrays.data() + offset, data, size * sizeof( T ) );
+          return offset;
+        }
+
+        const DBImpl& m_db;
+        /// Prefix of the ids of the entries of the tag.
+        const std::string m_root;
+
+        const IOV m_range;
+        bool      m_restricted = false;
+        /// Entries needed for the range (only for restricted snapshots).
+        std::unordered_set<std::string> m_selected;
+        /// Limits for which the IOVs file of the directories have been looked at.
+        std::unordered_map<std::string, std::vector<IOV>> m_iov_limits;
+
+        snapshot::string_ref m_tag;
+        std::int64_t         m_commit_time;
+
+        std::vector<snapshot::node>      m_nodes;
+        std::vector<snapshot::iov_table> m_iov_tables;
+        std::string                      m_arrays;
+
+        /// Distinct strings of the data section (the keys of m_data_offsets point to them).
+        std::vector<Payload>                                m_payloads;
+        std::unordered_map<std::string_view, std::uint64_t> m_data_offsets;
+        std::uint64_t                                       m_data_size = 0;
+      };
+    } // namespace details
+  }   // namespace v1
+} // namespace GitCondDB
+
+#endif // SNAPSHOTWRITER_H
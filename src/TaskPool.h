@@ -0,0 +1,102 @@
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+/*****************************************************************************\
+* (c) Copyright 2018 CERN for the benefit of the LHCb Collaboration           *
+*                                                                             *
+* This software is distributed under the terms of the Apache version 2        *
+* licence, copied verbatim in the file "COPYING".                             *
+*                                                                             *
+* In applying this licence, CERN does not waive the privileges and immunities *
+* granted to it by virtue of its status as an Intergovernmental Organization  *
+* or submit itself to any jurisdiction.                                       *
+\*****************************************************************************/
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace GitCondDB {
+  inline namespace v1 {
+    namespace details {
+      /// Simple pool of worker threads executing tasks in FIFO order.
+      ///
+      /// The threads are started only when the first task is posted, and the
+      /// destructor waits for all the queued tasks to be executed.
+      class TaskPool {
+      public:
+        explicit TaskPool( std::size_t n_threads ) : m_n_threads{std::max<std::size_t>( n_threads, 1 )} {}
+
+        ~TaskPool() {
+          {
+            std::lock_guard<std::mutex> guard( m_mutex );
+            m_stop = true;
+          }
+          m_cv.notify_all();
+          for ( auto& t : m_threads ) t.join();
+        }
+
+        TaskPool( const TaskPool& ) = delete;
+        TaskPool& operator=( const TaskPool& ) = delete;
+
+        /// Queue a task.
+        void post( std::function<void()> task ) {
+          {
+            std::lock_guard<std::mutex> guard( m_mutex );
+            if ( m_threads.empty() ) start();
+            m_queue.emplace_back( std::move( task ) );
+          }
+          m_cv.notify_one();
+        }
+
+        /// Queue a task, returning a future for its result.
+        template <class FUNC>
+        std::future<std::invoke_result_t<FUNC>> submit( FUNC&& func ) {
+          using result_t = std::invoke_result_t<FUNC>;
+          auto task      = std::make_shared<std::packaged_task<result_t()>>( std::forward<FUNC>( func ) );
+          auto result    = task->get_future();
+          post( [task]() { ( *task )(); } );
+          return result;
+        }
+
+        std::size_t size() const { return m_n_threads; }
+
+      private:
+        void start() {
+          m_threads.reserve( m_n_threads );
+          for ( std::size_t i = 0; i < m_n_threads; ++i ) m_threads.emplace_back( [this]() { run(); } );
+        }
+
+        void run() {
+          while ( true ) {
+            std::function<void()> task;
+            {
+              std::unique_lock<std::mutex> lock( m_mutex );
+              m_cv.wait( lock, [this]() { return m_stop || !m_queue.empty(); } );
+              if ( m_queue.empty() ) return; // stopped and nothing left to do
+              task = std::move( m_queue.front() );
+              m_queue.pop_front();
+            }
+            task();
+          }
+        }
+
+        std::size_t m_n_threads;
+
+        std::vector<std::thread>          m_threads;
+        std::deque<std::function<void()>> m_queue;
+        bool                              m_stop = false;
+        std::mutex                        m_mutex;
+        std::condition_variable           m_cv;
+      };
+    } // namespace details
+  }   // namespace v1
+} // namespace GitCondDB
+
+#endif // TASKPOOL_H
@@ -0,0 +1,164 @@
+#ifndef WATCHER_H
+#define WATCHER_H
+/*****************************************************************************\
+* (c) Copyright 2018 CERN for the benefit of the LHCb Collaboration           *
+*                                                                             *
+* This software is distributed under the terms of the Apache version 2        *
+* licence, copied verbatim in the file "COPYING".                             *
+*                                                                             *
+* In applying this licence, CERN does not waive the privileges and immunities *
+* granted to it by virtue of its status as an Intergovernmental Organization  *
+* or submit itself to any jurisdiction.                                       *
+\*****************************************************************************/
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#  include <cerrno>
+#  include <cstring>
+#  include <unordered_map>
+
+#  include <dirent.h>
+#  include <fcntl.h>
+#  include <poll.h>
+#  include <sys/inotify.h>
+#  include <unistd.h>
+#endif
+
+namespace GitCondDB {
+  inline namespace v1 {
+    namespace details {
+      /// Thread watching directories for modifications (with inotify), calling an action
+      /// once for each burst of changes.
+      ///
+      /// The action is called when no other modification is seen for a short delay, so that
+      /// an update written in several steps (e.g. a lock file renamed to a reference) triggers
+      /// a single call. The destructor stops the thread, waiting for the action to complete.
+      ///
+      /// inotify does not report changes in subdirectories, so the directories watched recursively
+      /// (e.g. hierarchical references like "refs/tags/release/v1") get a watch for each of their
+      /// subdirectories, including those created later.
+      class Watcher {
+      public:
+        /// Directory to watch, with all its subdirectories if recursive.
+        struct directory {
+          std::string path;
+          bool        recursive = false;
+        };
+
+        Watcher( const std::vector<directory>& dirs, std::function<void()> action,
+                 std::chrono::milliseconds delay = std::chrono::milliseconds{50} )
+            : m_action{std::move( action )}, m_delay{delay} {
+#ifdef __linux__
+          m_inotify = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+          if ( m_inotify < 0 ) throw std::runtime_error{std::string{"cannot watch for changes: "} + strerror( errno )};
+          bool watching = false;
+          for ( const auto& dir : dirs ) {
+            // directories that do not exist (e.g. no tags in the repository) are ignored
+            watching |= add_watch( dir.path, dir.recursive );
+          }
+          if ( !watching || pipe2( m_stop, O_CLOEXEC ) ) {
+            close( m_inotify );
+            throw std::runtime_error{"cannot watch for changes: " +
+                                     ( watching ? std::string{strerror( errno )} : "nothing to watch" )};
+          }
+          m_thread = std::thread{[this]() { run(); }};
+#else
+          (void)dirs;
+          throw std::runtime_error{"watching for changes is not supported on this platform"};
+#endif
+        }
+
+        ~Watcher() {
+#ifdef __linux__
+          const char stop = 0;
+          while ( write( m_stop[1], &stop, 1 ) < 0 && errno == EINTR ) {}
+          m_thread.join();
+          close( m_stop[0] );
+          close( m_stop[1] );
+          close( m_inotify );
+#endif
+        }
+
+        Watcher( const Watcher& ) = delete;
+        Watcher& operator=( const Watcher& ) = delete;
+
+      private:
+#ifdef __linux__
+        void run() {
+          pollfd fds[2] = {{m_inotify, POLLIN, 0}, {m_stop[0], POLLIN, 0}};
+          while ( true ) {
+            if ( poll( fds, 2, -1 ) < 0 ) {
+              if ( errno == EINTR ) continue;
+              return;
+            }
+            // wait for the end of the burst of modifications
+            int ready = 0;
+            do {
+              if ( fds[1].revents ) return;
+              drain();
+            } while ( ( ready = poll( fds, 2, static_cast<int>( m_delay.count() ) ) ) > 0 ||
+                      ( ready < 0 && errno == EINTR ) );
+            m_action();
+          }
+        }
+
+        /// Watch a directory (and its subdirectories if recursive), returning false if it cannot be watched.
+        bool add_watch( const std::string& path, bool recursive ) {
+          const int wd = inotify_add_watch( m_inotify, path.c_str(), events | ( recursive ? IN_ONLYDIR : 0 ) );
+          if ( wd < 0 ) return false;
+          if ( recursive ) {
+            m_trees[wd] = path;
+            if ( DIR* dir = opendir( path.c_str() ) ) {
+              while ( const dirent* entry = readdir( dir ) ) {
+                if ( entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN ) continue;
+                if ( strcmp( entry->d_name, "." ) == 0 || strcmp( entry->d_name, ".." ) == 0 ) continue;
+                add_watch( path + '/' + entry->d_name, true );
+              }
+              closedir( dir );
+            }
+          }
+          return true;
+        }
+
+        /// Discard the pending events (we only need to know that something changed), except for
+        /// the creation of subdirectories of the directories watched recursively, which are watched too.
+        void drain() {
+          alignas( inotify_event ) char buffer[4096];
+          ssize_t                       size = 0;
+          while ( ( size = read( m_inotify, buffer, sizeof( buffer ) ) ) > 0 ) {
+            for ( const char* pos = buffer; pos < buffer + size; ) {
+              const auto* event = reinterpret_cast<const inotify_event*>( pos );
+              pos += sizeof( inotify_event ) + event->len;
+              if ( event->mask & IN_IGNORED ) {
+                m_trees.erase( event->wd );
+              } else if ( ( event->mask & IN_ISDIR ) && ( event->mask & ( IN_CREATE | IN_MOVED_TO ) ) ) {
+                if ( auto tree = m_trees.find( event->wd ); tree != m_trees.end() )
+                  add_watch( tree->second + '/' + event->name, true );
+              }
+            }
+          }
+        }
+
+        static constexpr std::uint32_t events = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE;
+
+        int         m_inotify = -1;
+        int         m_stop[2] = {-1, -1};
+        std::thread m_thread;
+        /// Paths of the directories watched recursively, by watch descriptor.
+        std::unordered_map<int, std::string> m_trees;
+#endif
+        std::function<void()>     m_action;
+        std::chrono::milliseconds m_delay;
+      };
+    } // namespace details
+  }   // namespace v1
+} // namespace GitCondDB
+
+#endif // WATCHER_H
@@ -0,0 +1,465 @@
+/*****************************************************************************\
+* (c) Copyright 2018 CERN for the benefit of the LHCb Collaboration           *
+*                                                                             *
+* This software is distributed under the terms of the Apache version 2        *
+* licence, copied verbatim in the file "COPYING".                             *
+*                                                                             *
+* In applying this licence, CERN does not waive the privileges and immunities *
+* granted to it by virtue of its status as an Intergovernmental Organization  *
+* or submit itself to any jurisdiction.                                       *
+\*****************************************************************************/
+
+#include "GitCondDB.h"
+
+#include "JSONTree.h"
+#include "path_helpers.h"
+
+#include <benchmark/benchmark.h>
+#include <nlohmann/json.hpp>
+
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <regex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#ifdef __GLIBC__
+#  include <malloc.h>
+#endif
+
+using namespace GitCondDB::v1;
+
+// The data is generated with "prepare_test_data.py --benchmark" (see create_benchmark_repo).
+namespace {
+  constexpr std::size_t n_systems      = 20;
+  constexpr std::size_t n_conditions   = 100; // per system
+  constexpr std::size_t large_iovs     = 100000;
+  constexpr std::size_t large_iov_step = 1000;
+
+  constexpr auto git_repo  = "bench_data/repo";
+  constexpr auto pack_repo = "bench_data/repo-packed.git";
+  constexpr auto file_repo = "file:bench_data/repo";
+  constexpr auto json_repo = "json:bench_data/repo.json";
+  constexpr auto snap_repo = "snapshot:bench_data/repo.snapshot";
+
+  const std::vector<std::string>& condition_paths() {
+    static const std::vector<std::string> paths = []() {
+      std::vector<std::string> paths;
+      char                     buffer[64];
+      for ( std::size_t i = 0; i < n_systems; ++i ) {
+        for ( std::size_t j = 0; j < n_conditions; ++j ) {
+          std::snprintf( buffer, sizeof( buffer ), "Conditions/Sys%02zu/Cond%03zu.xml", i, j );
+          paths.emplace_back( buffer );
+        }
+      }
+      return paths;
+    }();
+    return paths;
+  }
+
+  // time points within the three IOVs of the conditions
+  constexpr CondDB::time_point_t time_points[] = {0, 1451606400000000000 + 1, 1483228800000000000 + 1};
+
+  // original regex based implementation of normalize
+  std::string regex_normalize( std::string path ) {
+    static const std::regex ignored_re{"(/[^/]+/\\.\\./)|(/\\./)"};
+    std::string             old_path;
+    while ( old_path.length() != path.length() ) {
+      old_path.swap( path );
+      path = std::regex_replace( old_path, ignored_re, "/" );
+    }
+    return path;
+  }
+
+  void check( bool condition, const char* msg ) {
+    if ( !condition ) throw std::runtime_error{msg};
+  }
+
+#ifdef __GLIBC__
+  /// Bytes currently allocated on the heap.
+  std::size_t heap_usage() {
+    const auto info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+  }
+#else
+  std::size_t heap_usage() { return 0; }
+#endif
+
+  /// Resident set size of the process in bytes (0 if not available).
+  std::size_t resident_memory() {
+    std::ifstream statm{"/proc/self/statm"};
+    std::size_t   size = 0, resident = 0;
+    if ( !( statm >> size >> resident ) ) return 0;
+    return resident * sysconf( _SC_PAGESIZE );
+  }
+
+  /// libgit2 tunings for BM_GetTuned (the first one restores the libgit2 defaults).
+  const std::vector<GitOptions>& git_tunings() {
+    static const std::vector<GitOptions> tunings = []() {
+      std::vector<GitOptions> tunings( 3 );
+      // libgit2 defaults
+      tunings[0].object_cache_size       = 256 << 20;
+      tunings[0].object_cache_blob_limit = 0;
+      tunings[0].mwindow_size            = std::size_t{1} << 30;
+      tunings[0].mwindow_mapped_limit    = std::size_t{8} << 30;
+      tunings[0].open_packfiles          = 128;
+      // memory constrained
+      tunings[1].object_cache_size    = 1 << 20;
+      tunings[1].mwindow_size         = 64 << 10;
+      tunings[1].mwindow_mapped_limit = 1 << 20;
+      tunings[1].open_packfiles       = 4;
+      // latency bound: payloads kept in the object cache
+      tunings[2]                         = tunings[0];
+      tunings[2].object_cache_size       = 512 << 20;
+      tunings[2].object_cache_blob_limit = 2 << 20;
+      return tunings;
+    }();
+    return tunings;
+  }
+} // namespace
+
+/// Conditions with a few IOVs, accessed in turn.
+static void BM_Get( benchmark::State& state, const char* repository ) {
+  CondDB      db    = connect( repository );
+  const auto& paths = condition_paths();
+  std::size_t i     = 0;
+  for ( auto _ : state ) {
+    benchmark::DoNotOptimize( db.get( {"v1", paths[i % paths.size()], time_points[i % 3]} ) );
+    ++i;
+  }
+}
+BENCHMARK_CAPTURE( BM_Get, git, git_repo );
+BENCHMARK_CAPTURE( BM_Get, file, file_repo );
+BENCHMARK_CAPTURE( BM_Get, json, json_repo );
+BENCHMARK_CAPTURE( BM_Get, snapshot, snap_repo );
+
+/// Same as BM_Get, but from several threads using the same instance.
+static void BM_GetThreads( benchmark::State& state ) {
+  static CondDB db    = connect( git_repo );
+  const auto&   paths = condition_paths();
+  std::size_t   i     = state.thread_index() * 7;
+  for ( auto _ : state ) {
+    benchmark::DoNotOptimize( db.get( {"v1", paths[i % paths.size()], time_points[i % 3]} ) );
+    ++i;
+  }
+}
+BENCHMARK( BM_GetThreads )->ThreadRange( 1, 64 )->UseRealTime();
+
+/// Condition resolved through a chain of IOVs files pointing to "../previous".
+static void BM_GetDeep( benchmark::State& state, const char* repository ) {
+  CondDB db = connect( repository );
+  check( std::get<0>( db.get( {"v1", "Deep.xml", 0} ) ).find( "\"Deep\"" ) != std::string::npos, "invalid data" );
+  for ( auto _ : state ) { benchmark::DoNotOptimize( db.get( {"v1", "Deep.xml", 0} ) ); }
+}
+BENCHMARK_CAPTURE( BM_GetDeep, git, git_repo );
+BENCHMARK_CAPTURE( BM_GetDeep, file, file_repo );
+BENCHMARK_CAPTURE( BM_GetDeep, json, json_repo );
+BENCHMARK_CAPTURE( BM_GetDeep, snapshot, snap_repo );
+
+/// Random time points in a condition with a large IOVs file.
+static void BM_GetLargeIOVs( benchmark::State& state, const char* repository ) {
+  CondDB                                              db = connect( repository );
+  std::mt19937                                        gen{42};
+  std::uniform_int_distribution<CondDB::time_point_t> t( 0, large_iovs * large_iov_step );
+  for ( auto _ : state ) { benchmark::DoNotOptimize( db.get( {"v1", "Large.xml", t( gen )} ) ); }
+}
+BENCHMARK_CAPTURE( BM_GetLargeIOVs, git, git_repo );
+BENCHMARK_CAPTURE( BM_GetLargeIOVs, file, file_repo );
+BENCHMARK_CAPTURE( BM_GetLargeIOVs, json, json_repo );
+BENCHMARK_CAPTURE( BM_GetLargeIOVs, snapshot, snap_repo );
+
+/// Payloads of all the conditions in two tags (mostly identical) held at the same time, reporting the
+/// total size of the payloads and the size of the distinct ones kept in memory.
+static void BM_HoldTags( benchmark::State& state, const char* repository ) {
+  CondDB      db    = connect( repository );
+  const auto& paths = condition_paths();
+  std::size_t total = 0, distinct = 0;
+  for ( auto _ : state ) {
+    std::vector<CondDB::Payload> held;
+    held.reserve( 2 * paths.size() );
+    for ( const char* tag : {"v0", "v1"} ) {
+      for ( const auto& path : paths ) held.emplace_back( std::get<0>( db.get_payload( {tag, path, 0} ) ) );
+    }
+    total = 0;
+    for ( const auto& p : held ) total += p.size();
+    distinct = db.payload_dedup_stats().bytes;
+  }
+  state.counters["held"] = benchmark::Counter( total, benchmark::Counter::kDefaults, benchmark::Counter::kIs1024 );
+  state.counters["distinct"] =
+      benchmark::Counter( distinct, benchmark::Counter::kDefaults, benchmark::Counter::kIs1024 );
+}
+BENCHMARK_CAPTURE( BM_HoldTags, git, git_repo )->Unit( benchmark::kMillisecond );
+
+/// Comparison of the conditions in several tags (v0 and v1, repeated), with a get() per tag or with get_in_tags().
+static void BM_CompareTags( benchmark::State& state, const char* repository ) {
+  CondDB                         db = connect( repository );
+  const std::vector<std::string> tags{"v0", "v1", "v0", "v1", "v0", "v1", "v0", "v1"};
+  const auto&                    paths = condition_paths();
+  std::size_t                    i     = 0;
+  for ( auto _ : state ) {
+    const auto& path       = paths[i % paths.size()];
+    const auto  time_point = time_points[i % 3];
+    std::size_t differ     = 0;
+    if ( state.range( 0 ) ) {
+      differ = db.get_in_tags( tags, path, time_point ).groups.size();
+    } else {
+      const auto reference = std::get<0>( db.get( {tags[0], path, time_point} ) );
+      for ( std::size_t t = 1; t < tags.size(); ++t ) {
+        if ( std::get<0>( db.get( {tags[t], path, time_point} ) ) != reference ) ++differ;
+      }
+    }
+    benchmark::DoNotOptimize( differ );
+    ++i;
+  }
+}
+BENCHMARK_CAPTURE( BM_CompareTags, git, git_repo )->Arg( 0 )->Arg( 1 );
+
+/// Conditions changed between v0 and v1, comparing the timelines of all the conditions or with changed_paths().
+static void BM_ChangedPaths( benchmark::State& state, const char* repository ) {
+  CondDB      db    = connect( repository );
+  const auto& paths = condition_paths();
+  std::size_t n     = 0;
+  for ( auto _ : state ) {
+    if ( state.range( 0 ) ) {
+      n = db.changed_paths( "v0", "v1", "Conditions" ).size();
+    } else {
+      n = 0;
+      for ( const auto& path : paths ) {
+        const auto old_timeline = db.iov_timeline( "v0", path );
+        const auto new_timeline = db.iov_timeline( "v1", path );
+        const bool same         = std::equal(
+            old_timeline.begin(), old_timeline.end(), new_timeline.begin(), new_timeline.end(),
+            []( const auto& a, const auto& b ) { return a.iov.since == b.iov.since && a.content_id == b.content_id; } );
+        if ( !same ) ++n;
+      }
+    }
+  }
+  state.counters["changed"] = n;
+}
+BENCHMARK_CAPTURE( BM_ChangedPaths, git, git_repo )->Arg( 0 )->Arg( 1 )->Unit( benchmark::kMillisecond );
+
+/// Big payloads, copied in a std::string.
+static void BM_GetBig( benchmark::State& state, const char* repository ) {
+  CondDB     db   = connect( repository );
+  const auto path = "Big/" + std::to_string( state.range( 0 ) ) + "MiB";
+  for ( auto _ : state ) { benchmark::DoNotOptimize( db.get( {"v1", path, 0} ) ); }
+  state.SetBytesProcessed( state.iterations() * ( state.range( 0 ) << 20 ) );
+}
+BENCHMARK_CAPTURE( BM_GetBig, git, git_repo )->Arg( 1 )->Arg( 16 );
+BENCHMARK_CAPTURE( BM_GetBig, file, file_repo )->Arg( 1 )->Arg( 16 );
+BENCHMARK_CAPTURE( BM_GetBig, json, json_repo )->Arg( 1 )->Arg( 16 );
+BENCHMARK_CAPTURE( BM_GetBig, snapshot, snap_repo )->Arg( 1 )->Arg( 16 );
+
+/// Big payloads, accessed without copies.
+static void BM_GetPayloadBig( benchmark::State& state, const char* repository ) {
+  CondDB     db   = connect( repository );
+  const auto path = "Big/" + std::to_string( state.range( 0 ) ) + "MiB";
+  for ( auto _ : state ) { benchmark::DoNotOptimize( db.get_payload( {"v1", path, 0} ) ); }
+  state.SetBytesProcessed( state.iterations() * ( state.range( 0 ) << 20 ) );
+}
+BENCHMARK_CAPTURE( BM_GetPayloadBig, git, git_repo )->Arg( 1 )->Arg( 16 );
+BENCHMARK_CAPTURE( BM_GetPayloadBig, file, file_repo )->Arg( 1 )->Arg( 16 );
+BENCHMARK_CAPTURE( BM_GetPayloadBig, json, json_repo )->Arg( 1 )->Arg( 16 );
+BENCHMARK_CAPTURE( BM_GetPayloadBig, snapshot, snap_repo )->Arg( 1 )->Arg( 16 );
+
+static void BM_IOVBoundariesDeep( benchmark::State& state, const char* repository ) {
+  CondDB db = connect( repository );
+  for ( auto _ : state ) { benchmark::DoNotOptimize( db.iov_boundaries( "v1", "Deep.xml" ) ); }
+}
+BENCHMARK_CAPTURE( BM_IOVBoundariesDeep, git, git_repo );
+BENCHMARK_CAPTURE( BM_IOVBoundariesDeep, file, file_repo );
+BENCHMARK_CAPTURE( BM_IOVBoundariesDeep, json, json_repo );
+BENCHMARK_CAPTURE( BM_IOVBoundariesDeep, snapshot, snap_repo );
+
+static void BM_IOVBoundariesLarge( benchmark::State& state, const char* repository ) {
+  CondDB db = connect( repository );
+  check( db.iov_boundaries( "v1", "Large.xml" ).size() == large_iovs, "unexpected number of boundaries" );
+  for ( auto _ : state ) { benchmark::DoNotOptimize( db.iov_boundaries( "v1", "Large.xml" ) ); }
+}
+BENCHMARK_CAPTURE( BM_IOVBoundariesLarge, git, git_repo );
+BENCHMARK_CAPTURE( BM_IOVBoundariesLarge, file, file_repo );
+BENCHMARK_CAPTURE( BM_IOVBoundariesLarge, json, json_repo );
+BENCHMARK_CAPTURE( BM_IOVBoundariesLarge, snapshot, snap_repo );
+
+/// First (uncached) query on a new connection, looking up the entries with N threads.
+static void BM_IOVBoundariesCold( benchmark::State& state, const char* repository ) {
+  const auto n_threads = static_cast<std::size_t>( state.range( 0 ) );
+  for ( auto _ : state ) {
+    state.PauseTiming();
+    auto db = std::make_unique<CondDB>( connect( repository ) );
+    state.ResumeTiming();
+    benchmark::DoNotOptimize( db->iov_boundaries( "v1", "Large.xml", {}, n_threads ) );
+    state.PauseTiming();
+    db.reset();
+    state.ResumeTiming();
+  }
+}
+BENCHMARK_CAPTURE( BM_IOVBoundariesCold, git, git_repo )->Arg( 1 )->Arg( 8 );
+BENCHMARK_CAPTURE( BM_IOVBoundariesCold, file, file_repo )->Arg( 1 )->Arg( 8 );
+
+/// Load the payloads of 1000 IOVs of a condition, with one get per boundary (0) or with iov_timeline (1).
+static void BM_LoadTimeline( benchmark::State& state, const char* repository ) {
+  CondDB            db = connect( repository );
+  const CondDB::IOV range{0, 1000 * large_iov_step};
+  for ( auto _ : state ) {
+    if ( state.range( 0 ) ) {
+      benchmark::DoNotOptimize( db.iov_timeline( "v1", "Large.xml", range, true ) );
+    } else {
+      for ( const auto since : db.iov_boundaries( "v1", "Large.xml", range ) ) {
+        benchmark::DoNotOptimize( db.get_payload( {"v1", "Large.xml", since}, range ) );
+      }
+    }
+  }
+}
+BENCHMARK_CAPTURE( BM_LoadTimeline, git, git_repo )->Arg( 0 )->Arg( 1 );
+
+/// Listing of a directory containing conditions (each has to be checked for an IOVs file).
+static void BM_Directory( benchmark::State& state, const char* repository ) {
+  CondDB db = connect( repository );
+  for ( auto _ : state ) { benchmark::DoNotOptimize( db.get( {"v1", "Conditions/Sys00", 0} ) ); }
+}
+BENCHMARK_CAPTURE( BM_Directory, git, git_repo );
+BENCHMARK_CAPTURE( BM_Directory, file, file_repo );
+BENCHMARK_CAPTURE( BM_Directory, json, json_repo );
+BENCHMARK_CAPTURE( BM_Directory, snapshot, snap_repo );
+
+static void BM_CommitTime( benchmark::State& state ) {
+  CondDB db = connect( git_repo );
+  for ( auto _ : state ) { benchmark::DoNotOptimize( db.commit_time( "v1" ) ); }
+}
+BENCHMARK( BM_CommitTime );
+
+/// Connection to the database followed by one access.
+static void BM_Connect( benchmark::State& state, const char* repository ) {
+  for ( auto _ : state ) {
+    CondDB db = connect( repository );
+    benchmark::DoNotOptimize( db.get( {"v1", "Conditions/Sys00/Cond000.xml", 0} ) );
+  }
+}
+BENCHMARK_CAPTURE( BM_Connect, git, git_repo );
+BENCHMARK_CAPTURE( BM_Connect, file, file_repo );
+BENCHMARK_CAPTURE( BM_Connect, json, json_repo )->Unit( benchmark::kMillisecond );
+BENCHMARK_CAPTURE( BM_Connect, snapshot, snap_repo );
+
+/// Access after disconnecting (i.e. reopening the repository).
+static void BM_Reconnect( benchmark::State& state ) {
+  CondDB db = connect( git_repo );
+  for ( auto _ : state ) {
+    db.disconnect();
+    benchmark::DoNotOptimize( db.get( {"v1", "Conditions/Sys00/Cond000.xml", 0} ) );
+  }
+}
+BENCHMARK( BM_Reconnect );
+
+/// Connection and one access reusing the repository handle released by the previous connection.
+static void BM_ConnectWarm( benchmark::State& state ) {
+  keep_idle_repositories();
+  for ( auto _ : state ) {
+    CondDB db = connect( git_repo );
+    benchmark::DoNotOptimize( db.get( {"v1", "Conditions/Sys00/Cond000.xml", 0} ) );
+  }
+  keep_idle_repositories( 0 );
+}
+BENCHMARK( BM_ConnectWarm );
+
+/// Same access pattern as BM_Get on a packed repository, with libgit2 tunings (0: defaults, 1: memory
+/// constrained, 2: latency bound), reporting the resident memory at the end.
+static void BM_GetTuned( benchmark::State& state ) {
+  const auto& tunings = git_tunings();
+  close_idle_repositories();
+  const auto  before = resident_memory();
+  CondDB      db     = connect( pack_repo, tunings[state.range( 0 )] );
+  const auto& paths  = condition_paths();
+  std::size_t i      = 0;
+  for ( auto _ : state ) {
+    benchmark::DoNotOptimize( db.get( {"v1", paths[i % paths.size()], time_points[i % 3]} ) );
+    if ( i % 64 == 0 ) benchmark::DoNotOptimize( db.get( {"v1", "Big/1MiB", 0} ) );
+    ++i;
+  }
+  state.counters["rss"] = benchmark::Counter( resident_memory(), benchmark::Counter::kDefaults,
+                                              benchmark::Counter::kIs1024 );
+  state.counters["rss_delta"] = benchmark::Counter( double( resident_memory() ) - double( before ),
+                                                    benchmark::Counter::kDefaults, benchmark::Counter::kIs1024 );
+  db.disconnect();
+  close_idle_repositories();
+  connect( pack_repo, tunings[0] );
+}
+BENCHMARK( BM_GetTuned )->DenseRange( 0, 2 );
+
+/// JSON documents for BM_JSONLoad: the benchmark repository (a few large payloads) or a
+/// generated document with many small entries.
+static const std::string& json_document( std::int64_t id ) {
+  static const std::string repo = []() {
+    std::ifstream stream{"bench_data/repo.json"};
+    return std::string{std::istreambuf_iterator<char>{stream}, std::istreambuf_iterator<char>{}};
+  }();
+  static const std::string many = []() {
+    std::string out = R"({"Conditions":{)";
+    char        buffer[128];
+    for ( std::size_t i = 0; i < 300; ++i ) {
+      std::snprintf( buffer, sizeof( buffer ), R"(%s"Sys%03zu":{)", i ? "," : "", i );
+      out += buffer;
+      for ( std::size_t j = 0; j < 100; ++j ) {
+        std::snprintf( buffer, sizeof( buffer ),
+                       R"(%s"Cond%03zu.xml":{"IOVs":"0 v0\n1000 v1\n","v0":"<value>%zu</value>",)"
+                       R"("v1":"<value>%zu</value>"})",
+                       j ? "," : "", j, j, j + 1 );
+        out += buffer;
+      }
+      out += '}';
+    }
+    return out + "}}";
+  }();
+  return id ? many : repo;
+}
+
+/// Loading of the JSON data: nlohmann::json DOM (the original implementation of the JSON backend)
+/// or JSONTree, reporting the memory used by the loaded data.
+template <typename Loader>
+static void BM_JSONLoad( benchmark::State& state, Loader load ) {
+  const auto& document = json_document( state.range( 0 ) );
+  std::size_t memory   = 0;
+  for ( auto _ : state ) {
+    const auto before = heap_usage();
+    const auto data   = load( document );
+    memory            = heap_usage() - before;
+    benchmark::DoNotOptimize( data );
+  }
+  state.counters["memory"] = benchmark::Counter( memory, benchmark::Counter::kDefaults, benchmark::Counter::kIs1024 );
+  state.SetBytesProcessed( state.iterations() * document.size() );
+}
+BENCHMARK_CAPTURE( BM_JSONLoad, dom,
+                   []( std::string_view document ) {
+                     return std::make_shared<const nlohmann::json>( nlohmann::json::parse( document ) );
+                   } )
+    ->Arg( 0 )
+    ->Arg( 1 )
+    ->Unit( benchmark::kMillisecond );
+BENCHMARK_CAPTURE( BM_JSONLoad, tree,
+                   []( std::string_view document ) { return GitCondDB::details::JSONTree::parse( document ); } )
+    ->Arg( 0 )
+    ->Arg( 1 )
+    ->Unit( benchmark::kMillisecond );
+
+/// Paths as built while following IOVs files.
+static const char* const normalize_paths[] = {"Conditions/Sys00/Cond000.xml/v1",
+                                              "Deep.xml/16/../15/../14/../13/v13",
+                                              "changing.xml/2017/../2016/v1"};
+
+static void BM_Normalize( benchmark::State& state ) {
+  const std::string path = normalize_paths[state.range( 0 )];
+  for ( auto _ : state ) { benchmark::DoNotOptimize( GitCondDB::Helpers::normalize( path ) ); }
+}
+BENCHMARK( BM_Normalize )->DenseRange( 0, 2 );
+
+static void BM_NormalizeRegex( benchmark::State& state ) {
+  const std::string path = normalize_paths[state.range( 0 )];
+  for ( auto _ : state ) { benchmark::DoNotOptimize( regex_normalize( path ) ); }
+}
+BENCHMARK( BM_NormalizeRegex )->DenseRange( 0, 2 );
+
+BENCHMARK_MAIN();
@@ -16,7 +16,11 @@
 #include <git2.h>
 #include <memory>
 #include <mutex>
+#include <stdexcept>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace GitCondDB {
   namespace Helpers {
@@ -27,47 +31,260 @@ namespace GitCondDB {
     struct git_repository_deleter {
       void operator()( git_repository* ptr ) { git_repository_free( ptr ); }
     };
+    struct git_tree_deleter {
+      void operator()( git_tree* ptr ) { git_tree_free( ptr ); }
+    };
 
-    using git_object_ptr = std::unique_ptr<git_object, git_object_deleter>;
+    struct git_odb_deleter {
+      void operator()( git_odb* ptr ) { git_odb_free( ptr ); }
+    };
+    struct git_odb_object_deleter {
+      void operator()( git_odb_object* ptr ) { git_odb_object_free( ptr ); }
+    };
 
-    /// Helper class to allow on-demand connection to the git repository.
-    class git_repository_ptr {
+    using git_object_ptr     = std::unique_ptr<git_object, git_object_deleter>;
+    using git_tree_ptr       = std::unique_ptr<git_tree, git_tree_deleter>;
+    using git_odb_ptr        = std::unique_ptr<git_odb, git_odb_deleter>;
+    using git_odb_object_ptr = std::unique_ptr<git_odb_object, git_odb_object_deleter>;
+
+    /// Tree objects already loaded from a repository handle, by id.
+    class git_tree_cache {
     public:
-      using storage_t = std::unique_ptr<git_repository, git_repository_deleter>;
-      using factory_t = std::function<storage_t()>;
-      using pointer   = storage_t::pointer;
-      using reference = std::add_lvalue_reference<storage_t::element_type>::type;
+      /// Return the tree with the given id (or nullptr if it cannot be found).
+      /// The tree is owned by the cache.
+      const git_tree* get( git_repository* repo, const git_oid* id ) {
+        std::string key{reinterpret_cast<const char*>( id->id ), sizeof( id->id )};
+        if ( auto it = m_trees.find( key ); it != m_trees.end() ) return it->second.get();
+
+        git_tree* tree = nullptr;
+        if ( git_tree_lookup( &tree, repo, id ) ) return nullptr;
+        // keep the memory usage under control with a crude, but cheap, policy
+        if ( m_trees.size() >= max_size ) m_trees.clear();
+        return m_trees.emplace( std::move( key ), git_tree_ptr{tree} ).first->second.get();
+      }
 
-      git_repository_ptr( factory_t factory ) : m_factory( std::move( factory ) ) {}
+      void clear() { m_trees.clear(); }
 
-      pointer get() const {
-        {
-          std::lock_guard<std::mutex> guard( m_ptr_mutex );
-          if ( !m_ptr ) {
-            m_ptr = m_factory();
-            if ( !m_ptr ) throw std::runtime_error( "unable create object" );
+      std::size_t size() const { return m_trees.size(); }
+
+      static constexpr std::size_t max_size = 8192;
+
+    private:
+      std::unordered_map<std::string, git_tree_ptr> m_trees;
+    };
+
+    /// A repository handle with the trees loaded through it.
+    struct git_repository_slot {
+      std::unique_ptr<git_repository, git_repository_deleter> repo;
+      git_tree_cache                                          trees;
+    };
+
+    /// Process-wide store of the repository handles not in use, by repository path.
+    ///
+    /// If enabled with set_max_idle(), the handles released by disconnect() (or by the destruction of
+    /// the CondDB instance) are kept here, so that the next connection to the same repository gets a
+    /// handle with warm caches (parsed objects, trees, loaded pack indexes) instead of opening the
+    /// repository again. Idle handles keep their pack files open and mapped, so by default (max_idle
+    /// set to 0) the released handles are closed.
+    ///
+    /// The registry also initializes libgit2 once for the whole process, and it is kept alive by the
+    /// users of instance(), so that libgit2 is shut down only after the last of them is gone.
+    class git_repository_registry {
+    public:
+      static std::shared_ptr<git_repository_registry> instance() {
+        static const std::shared_ptr<git_repository_registry> registry{new git_repository_registry};
+        return registry;
+      }
+
+      ~git_repository_registry() {
+        clear();
+        git_libgit2_shutdown();
+      }
+
+      git_repository_registry( const git_repository_registry& ) = delete;
+      git_repository_registry& operator=( const git_repository_registry& ) = delete;
+
+      /// Get an idle handle for the repository, if any.
+      bool take( const std::string& path, git_repository_slot& out ) {
+        std::lock_guard<std::mutex> guard( m_mutex );
+        auto                        it = m_idle.find( path );
+        if ( it == m_idle.end() || it->second.empty() ) return false;
+        out = std::move( it->second.back() );
+        it->second.pop_back();
+        return true;
+      }
+
+      /// Keep a handle that is not used anymore (it is closed if there are already enough idle handles).
+      void put( const std::string& path, git_repository_slot s ) {
+        std::lock_guard<std::mutex> guard( m_mutex );
+        if ( m_max_idle == 0 ) return;
+        auto& slots = m_idle[path];
+        if ( slots.size() < m_max_idle ) slots.emplace_back( std::move( s ) );
+      }
+
+      /// Set the maximum number of idle handles kept for each repository (0 to close them on release).
+      void set_max_idle( std::size_t value ) {
+        std::vector<git_repository_slot> dropped; // closed after releasing the lock
+        std::lock_guard<std::mutex>      guard( m_mutex );
+        m_max_idle = value;
+        for ( auto& [path, slots] : m_idle ) {
+          while ( slots.size() > m_max_idle ) {
+            dropped.emplace_back( std::move( slots.back() ) );
+            slots.pop_back();
           }
         }
-        return m_ptr.get();
       }
 
-      reference operator*() const { return *get(); }
+      std::size_t max_idle() const {
+        std::lock_guard<std::mutex> guard( m_mutex );
+        return m_max_idle;
+      }
 
-      pointer operator->() const { return get(); }
+      /// Close all the idle handles.
+      void clear() {
+        decltype( m_idle ) tmp;
+        std::lock_guard<std::mutex> guard( m_mutex );
+        m_idle.swap( tmp );
+      }
 
-      explicit operator bool() const { return get(); }
+      /// Number of idle handles for a repository.
+      std::size_t size( const std::string& path ) const {
+        std::lock_guard<std::mutex> guard( m_mutex );
+        auto                        it = m_idle.find( path );
+        return ( it == m_idle.end() ) ? 0 : it->second.size();
+      }
 
+    private:
+      git_repository_registry() { git_libgit2_init(); }
+
+      std::unordered_map<std::string, std::vector<git_repository_slot>> m_idle;
+      std::size_t                                                       m_max_idle = 0;
+      mutable std::mutex                                                m_mutex;
+    };
+
+    /// Helper class to allow on-demand connection to the git repository.
+    ///
+    /// libgit2 objects cannot be used concurrently from several threads, so the
+    /// pool gives exclusive use of a repository handle to each client (opening
+    /// new handles when needed) and takes it back when the client is done.
+    ///
+    /// The handles dropped by reset() (or at destruction) are passed to the recycler,
+    /// if any, instead of being closed.
+    class git_repository_pool {
+    public:
+      using storage_t  = std::unique_ptr<git_repository, git_repository_deleter>;
+      using slot       = git_repository_slot;
+      using factory_t  = std::function<slot()>;
+      using recycler_t = std::function<void( slot )>;
+      using pointer    = storage_t::pointer;
+
+      /// RAII object giving access to one of the repository handles in the pool.
+      class handle {
+      public:
+        handle( handle&& other )
+            : m_pool{std::exchange( other.m_pool, nullptr )}
+            , m_slot{std::move( other.m_slot )}
+            , m_generation{other.m_generation} {}
+        handle& operator=( handle&& ) = delete;
+
+        ~handle() {
+          if ( m_pool ) m_pool->release( std::move( m_slot ), m_generation );
+        }
+
+        pointer get() const { return m_slot.repo.get(); }
+
+        operator pointer() const { return get(); }
+
+        /// Cache of tree objects for this repository handle.
+        git_tree_cache& trees() { return m_slot.trees; }
+
+      private:
+        friend class git_repository_pool;
+        handle( const git_repository_pool* pool, slot s, std::size_t generation )
+            : m_pool{pool}, m_slot{std::move( s )}, m_generation{generation} {}
+
+        const git_repository_pool* m_pool;
+        slot                       m_slot;
+        std::size_t                m_generation;
+      };
+
+      git_repository_pool( factory_t factory, recycler_t recycler = {} )
+          : m_factory( std::move( factory ) ), m_recycler( std::move( recycler ) ) {}
+
+      ~git_repository_pool() { recycle( std::move( m_idle ) ); }
+
+      handle acquire() const {
+        std::unique_lock<std::mutex> guard( m_mutex );
+        ++m_in_use;
+        if ( !m_idle.empty() ) {
+          handle h{this, std::move( m_idle.back() ), m_generation};
+          m_idle.pop_back();
+          return h;
+        }
+        const auto generation = m_generation;
+        // opening a repository may be slow, so we do it without holding the lock
+        guard.unlock();
+        slot s;
+        try {
+          s = m_factory();
+          if ( !s.repo ) throw std::runtime_error( "unable create object" );
+        } catch ( ... ) {
+          std::lock_guard<std::mutex> g( m_mutex );
+          --m_in_use;
+          throw;
+        }
+        return {this, std::move( s ), generation};
+      }
+
+      /// Close all the repository handles (those in use are closed when released).
       void reset() {
-        std::lock_guard<std::mutex> guard( m_ptr_mutex );
-        m_ptr.reset();
+        std::vector<slot> idle;
+        {
+          std::lock_guard<std::mutex> guard( m_mutex );
+          idle.swap( m_idle );
+          m_in_use = 0;
+          ++m_generation;
+        }
+        recycle( std::move( idle ) );
+      }
+
+      /// Tell if there is at least one open repository handle.
+      bool is_set() const {
+        std::lock_guard<std::mutex> guard( m_mutex );
+        return m_in_use || !m_idle.empty();
       }
 
-      bool is_set() const { return bool{m_ptr}; }
+      /// Number of open repository handles.
+      std::size_t size() const {
+        std::lock_guard<std::mutex> guard( m_mutex );
+        return m_in_use + m_idle.size();
+      }
 
     private:
-      factory_t          m_factory;
-      mutable storage_t  m_ptr;
-      mutable std::mutex m_ptr_mutex;
+      void release( slot s, std::size_t generation ) const {
+        {
+          std::lock_guard<std::mutex> guard( m_mutex );
+          if ( generation == m_generation ) {
+            --m_in_use;
+            m_idle.emplace_back( std::move( s ) );
+            return;
+          }
+        }
+        // handles acquired before a reset are not part of the pool anymore
+        if ( m_recycler ) m_recycler( std::move( s ) );
+      }
+
+      void recycle( std::vector<slot> slots ) const {
+        if ( !m_recycler ) return;
+        for ( auto& s : slots ) m_recycler( std::move( s ) );
+      }
+
+      factory_t                 m_factory;
+      recycler_t                m_recycler;
+      mutable std::vector<slot> m_idle;
+      mutable std::size_t       m_in_use     = 0;
+      mutable std::size_t       m_generation = 0;
+      mutable std::mutex        m_mutex;
     };
   } // namespace Helpers
 } // namespace GitCondDB
@@ -15,62 +15,186 @@
 
 #include "common.h"
 
-#include <sstream>
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <tuple>
+#include <unordered_map>
+#include <vector>
 
 namespace GitCondDB {
   namespace Helpers {
-    std::tuple<std::string, CondDB::IOV> get_key_iov( const std::string& data, const CondDB::time_point_t t,
-                                                      const CondDB::IOV& boundaries  = {},
-                                                      const bool         reduce_iovs = true ) {
-      std::tuple<std::string, CondDB::IOV> out;
-      auto&                                key   = std::get<0>( out );
-      auto&                                since = std::get<1>( out ).since;
-      auto&                                until = std::get<1>( out ).until;
-
-      if ( UNLIKELY( t < boundaries.since || t >= boundaries.until ) ) {
-        since = until = 0;
-      } else {
-        CondDB::time_point_t current = 0;
-        std::string          line;
-
-        std::istringstream stream{data};
-        std::string        tmp_key;
-
-        while ( std::getline( stream, line ) ) {
-          std::istringstream is{line};
-          is >> current >> tmp_key;
-          if ( !reduce_iovs || tmp_key != key ) { // if we do not need to reduce IOVs, ignore identical keys
-            if ( current > t ) {
-              until = current; // what we read is the "until" for the previous key
-              break;           // and we need to use the previous key
-            }
-            key   = std::move( tmp_key );
-            since = current; // the time we read is the "since" for the read key
-          }
+    /// Pre-parsed content of an IOVs file.
+    ///
+    /// The file is parsed only once into contiguous arrays of "since" values and of
+    /// (interned) keys, so that the key valid at a given time point can be found with
+    /// a binary search.
+    ///
+    /// The index only holds views on the arrays, which are kept alive by an owner
+    /// object: the storage filled while parsing, or any external storage holding
+    /// the same arrays (e.g. a memory mapped snapshot file).
+    class IOVIndex {
+    public:
+      using time_point_t = CondDB::time_point_t;
+      using IOV          = CondDB::IOV;
+
+      /// View on the "since" values and key ids of a list of entries.
+      struct Table {
+        const time_point_t*  since   = nullptr;
+        const std::uint32_t* key_ids = nullptr;
+        /// Running maximum of since, used for the binary search (same as since if the entries are sorted).
+        const time_point_t* max_since = nullptr;
+        std::size_t         size      = 0;
+
+        bool sorted() const { return max_since == since; }
+      };
+
+      IOVIndex() = default;
+
+      explicit IOVIndex( std::string_view data ) {
+        auto storage = std::make_shared<Storage>();
+
+        std::unordered_map<std::string_view, std::uint32_t> key_ids;
+        std::vector<std::string_view>                       keys;
+
+        while ( !data.empty() ) {
+          const auto eol  = data.find( '\n' );
+          auto       line = data.substr( 0, eol );
+          data.remove_prefix( eol == data.npos ? data.size() : eol + 1 );
+
+          skip_spaces( line );
+          time_point_t since;
+          const auto   res = std::from_chars( line.data(), line.data() + line.size(), since );
+          if ( UNLIKELY( res.ec != std::errc{} ) ) continue; // ignore invalid lines
+          line.remove_prefix( static_cast<std::size_t>( res.ptr - line.data() ) );
+          skip_spaces( line );
+          const auto key = line.substr( 0, line.find_first_of( spaces ) );
+
+          auto [id, added] = key_ids.emplace( key, static_cast<std::uint32_t>( keys.size() ) );
+          if ( added ) keys.emplace_back( key );
+
+          storage->all.add( since, id->second );
+          // with IOV reduction, entries with the same key as the previous one are ignored
+          auto& reduced = storage->reduced;
+          if ( reduced.key_ids.empty() ? !key.empty() : reduced.key_ids.back() != id->second )
+            reduced.add( since, id->second );
         }
-        std::get<1>( out ).cut( boundaries );
+
+        // copy the keys, as data is not owned by the index
+        std::size_t length = 0;
+        for ( const auto& key : keys ) length += key.size();
+        storage->key_data.reserve( length );
+        m_keys.reserve( keys.size() );
+        for ( const auto& key : keys ) {
+          m_keys.emplace_back( storage->key_data.data() + storage->key_data.size(), key.size() );
+          storage->key_data.append( key );
+        }
+
+        m_all     = storage->all.view();
+        m_reduced = storage->reduced.view();
+        m_owner   = std::move( storage );
       }
-      return out;
-    }
 
-    std::vector<std::pair<CondDB::IOV, std::string>> parse_IOVs_keys( const std::string& data ) {
-      std::vector<std::pair<CondDB::IOV, std::string>> out;
-      std::string                                      line;
+      /// Index on tables already prepared, kept alive by owner.
+      IOVIndex( Table all, Table reduced, std::vector<std::string_view> keys, std::shared_ptr<const void> owner )
+          : m_all{all}, m_reduced{reduced}, m_keys{std::move( keys )}, m_owner{std::move( owner )} {}
+
+      /// Number of entries in the IOVs file.
+      std::size_t size() const { return m_all.size; }
+      bool        empty() const { return m_all.size == 0; }
+
+      /// Number of distinct keys in the IOVs file.
+      std::size_t distinct_keys() const { return m_keys.size(); }
 
-      CondDB::time_point_t bound;
-      std::string          key;
+      std::string_view key( std::size_t i ) const { return m_keys[m_all.key_ids[i]]; }
+      time_point_t     since( std::size_t i ) const { return m_all.since[i]; }
+      /// Validity of the entry i, (i.e. up to the beginning of the following one).
+      IOV iov( std::size_t i ) const { return {m_all.since[i], ( i + 1 < size() ) ? m_all.since[i + 1] : IOV::max()}; }
 
-      std::istringstream stream{data};
+      /// All the entries.
+      const Table& all() const { return m_all; }
+      /// Entries without the repetitions of the same key.
+      const Table& reduced() const { return m_reduced; }
+      /// Distinct keys, in order of appearance (the key ids of the tables are indices in this list).
+      const std::vector<std::string_view>& keys() const { return m_keys; }
 
-      while ( std::getline( stream, line ) ) {
-        std::istringstream is{line};
-        is >> bound >> key;
-        if ( LIKELY( !out.empty() ) ) { out.back().first.until = bound; }
-        out.emplace_back( CondDB::IOV{bound, CondDB::IOV::max()}, std::move( key ) );
+      /// Find the key valid at the time point t, and the corresponding IOV, restricted to boundaries.
+      ///
+      /// If t is not within the boundaries the returned IOV is not valid.
+      std::tuple<std::string_view, IOV> find( const time_point_t t, const IOV& boundaries = {},
+                                              const bool reduce_iovs = true ) const {
+        if ( UNLIKELY( t < boundaries.since || t >= boundaries.until ) ) return {std::string_view{}, IOV{0, 0}};
+
+        const auto& table = reduce_iovs ? m_reduced : m_all;
+
+        std::tuple<std::string_view, IOV> out;
+        // index of the first entry starting after t
+        const std::size_t next =
+            std::upper_bound( table.max_since, table.max_since + table.size, t ) - table.max_since;
+        if ( next ) {
+          std::get<0>( out )       = m_keys[table.key_ids[next - 1]];
+          std::get<1>( out ).since = table.since[next - 1];
+        }
+        if ( next < table.size ) std::get<1>( out ).until = table.since[next];
+        std::get<1>( out ).cut( boundaries );
+        return out;
       }
 
+    private:
+      static constexpr const char* spaces = " \t\r\v\f";
+
+      static void skip_spaces( std::string_view& s ) {
+        s.remove_prefix( std::min( s.find_first_not_of( spaces ), s.size() ) );
+      }
+
+      /// Arrays filled while parsing.
+      struct TableData {
+        std::vector<time_point_t>  since;
+        std::vector<std::uint32_t> key_ids;
+        /// Filled only if the entries are not sorted.
+        std::vector<time_point_t> max_since;
+
+        void add( time_point_t t, std::uint32_t key_id ) {
+          if ( UNLIKELY( !since.empty() && ( t < since.back() || !max_since.empty() ) ) ) {
+            if ( max_since.empty() ) max_since = since;
+            max_since.push_back( std::max( t, max_since.back() ) );
+          }
+          since.push_back( t );
+          key_ids.push_back( key_id );
+        }
+
+        Table view() const {
+          return {since.data(), key_ids.data(), max_since.empty() ? since.data() : max_since.data(), since.size()};
+        }
+      };
+
+      struct Storage {
+        TableData   all;
+        TableData   reduced;
+        std::string key_data;
+      };
+
+      Table                         m_all;
+      Table                         m_reduced;
+      std::vector<std::string_view> m_keys;
+      std::shared_ptr<const void>   m_owner;
+    };
+
+    inline std::tuple<std::string, CondDB::IOV> get_key_iov( const std::string& data, const CondDB::time_point_t t,
+                                                             const CondDB::IOV& boundaries  = {},
+                                                             const bool         reduce_iovs = true ) {
+      const auto [key, iov] = IOVIndex{data}.find( t, boundaries, reduce_iovs );
+      return {std::string{key}, iov};
+    }
+
+    inline std::vector<std::pair<CondDB::IOV, std::string>> parse_IOVs_keys( const std::string& data ) {
+      const IOVIndex                                   index{data};
+      std::vector<std::pair<CondDB::IOV, std::string>> out;
+      out.reserve( index.size() );
+      for ( std::size_t i = 0; i < index.size(); ++i ) out.emplace_back( index.iov( i ), std::string{index.key( i )} );
       return out;
     }
   } // namespace Helpers
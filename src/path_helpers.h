@@ -0,0 +1,79 @@
+#ifndef PATH_HELPERS_H
+#define PATH_HELPERS_H
+/*****************************************************************************\
+* (c) Copyright 2018 CERN for the benefit of the LHCb Collaboration           *
+*                                                                             *
+* This software is distributed under the terms of the Apache version 2        *
+* licence, copied verbatim in the file "COPYING".                             *
+*                                                                             *
+* In applying this licence, CERN does not waive the privileges and immunities *
+* granted to it by virtue of its status as an Intergovernmental Organization  *
+* or submit itself to any jurisdiction.                                       *
+\*****************************************************************************/
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace GitCondDB {
+  namespace Helpers {
+    /// Normalize a relative path, removing the "/parent/../" and "/./" entries.
+    ///
+    /// The result is exactly the same as replacing with "/" the matches of the regular
+    /// expression `(/[^/]+/\.\./)|(/\./)` until nothing changes, but the path is split
+    /// only once into '/' separated segments and the replacements are applied to them:
+    ///  - the first segment is never removed (it is not preceded by a '/'),
+    ///  - the last segment cannot trigger a removal (it is not followed by a '/'),
+    ///  - "x/.." removes both segments, whatever x is (but not empty),
+    ///  - "." is removed,
+    ///  - in one scan, the segment after a removal cannot start a match (its '/' is
+    ///    consumed by the previous match), so the scan is repeated until nothing changes
+    ///    (in practice one or two scans).
+    inline std::string normalize( std::string_view path ) {
+      // nothing to do without "/." or "/.."
+      if ( path.find( "/." ) == path.npos ) return std::string{path};
+
+      std::vector<std::string_view> segments;
+      segments.reserve( 16 );
+      for ( std::size_t start = 0;; ) {
+        const auto pos = path.find( '/', start );
+        segments.emplace_back( path.substr( start, pos == path.npos ? path.npos : pos - start ) );
+        if ( pos == path.npos ) break;
+        start = pos + 1;
+      }
+
+      bool changed = true;
+      while ( changed ) {
+        changed = false;
+        // segments[0] cannot be removed, and the last segment is never followed by '/'
+        const std::size_t last = segments.size() - 1;
+        std::size_t       w    = 1;
+        for ( std::size_t r = 1; r <= last; ) {
+          if ( r + 1 < last && !segments[r].empty() && segments[r + 1] == ".." ) {
+            r += 2; // "/x/../"
+          } else if ( r < last && segments[r] == "." ) {
+            r += 1; // "/./"
+          } else {
+            segments[w++] = segments[r++];
+            continue;
+          }
+          changed = true;
+          // the segment after a match is not preceded by a '/' as far as this scan is concerned
+          if ( r <= last ) segments[w++] = segments[r++];
+        }
+        segments.resize( w );
+      }
+
+      std::string out;
+      out.reserve( path.size() );
+      out.append( segments.front() );
+      for ( auto seg = segments.begin() + 1; seg != segments.end(); ++seg ) {
+        out += '/';
+        out.append( *seg );
+      }
+      return out;
+    }
+  } // namespace Helpers
+} // namespace GitCondDB
+
+#endif // PATH_HELPERS_H
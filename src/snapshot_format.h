@@ -0,0 +1,115 @@
+#ifndef SNAPSHOT_FORMAT_H
+#define SNAPSHOT_FORMAT_H
+/*****************************************************************************\
+* (c) Copyright 2018 CERN for the benefit of the LHCb Collaboration           *
+*                                                                             *
+* This software is distributed under the terms of the Apache version 2        *
+* licence, copied verbatim in the file "COPYING".                             *
+*                                                                             *
+* In applying this licence, CERN does not waive the privileges and immunities *
+* granted to it by virtue of its status as an Intergovernmental Organization  *
+* or submit itself to any jurisdiction.                                       *
+\*****************************************************************************/
+
+#include <GitCondDB.h>
+
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+namespace GitCondDB {
+  inline namespace v1 {
+    namespace details {
+      /// Layout of the snapshot files, i.e. the content of one tag compiled in a single file
+      /// meant to be memory mapped and used as it is.
+      ///
+      /// The file is made of a header followed by four sections, each starting at an offset
+      /// multiple of 8 bytes:
+      ///  - nodes: the entries of the tree (the root first), where the entries of a directory
+      ///    are contiguous and sorted by name, so that paths are resolved with binary searches,
+      ///  - iov_tables: the IOVs files, pre-parsed (see Helpers::IOVIndex),
+      ///  - arrays: the "since" values, key ids and keys of the IOVs tables,
+      ///  - data: names and content of the files (identical strings are stored only once).
+      ///
+      /// All the numbers are in the native byte order of the machine that wrote the file.
+      namespace snapshot {
+        constexpr char          magic[8]   = {'G', 'I', 'T', 'C', 'O', 'N', 'D', 'S'};
+        constexpr std::uint32_t version    = 1;
+        constexpr std::uint32_t byte_order = 0x01020304;
+
+        /// Value of header::commit_time when the tag is not a commit.
+        constexpr std::int64_t no_commit_time = std::numeric_limits<std::int64_t>::max();
+        /// Value of node::iovs for files and directories without an IOVs file.
+        constexpr std::uint32_t no_iovs = std::numeric_limits<std::uint32_t>::max();
+
+        /// Position of a string in the data section.
+        struct string_ref {
+          std::uint64_t offset;
+          std::uint64_t size;
+        };
+
+        /// Position of a section in the file: offset in bytes and number of elements (or bytes).
+        struct section {
+          std::uint64_t offset;
+          std::uint64_t size;
+        };
+
+        struct header {
+          char          magic[8];
+          std::uint32_t version;
+          std::uint32_t byte_order;
+          /// Name of the tag used to create the snapshot.
+          string_ref tag;
+          /// Time of the commit of the tag, in seconds since epoch.
+          std::int64_t commit_time;
+          /// Range of time points for which the snapshot is valid.
+          std::uint64_t since;
+          std::uint64_t until;
+          section      nodes;
+          section      iov_tables;
+          section      arrays;
+          section      data;
+        };
+
+        enum node_type : std::uint32_t { file = 0, directory = 1 };
+
+        struct node {
+          string_ref    name;
+          std::uint32_t type;
+          /// Index of the table of the IOVs file of a directory.
+          std::uint32_t iovs;
+          /// Offset of the content of a file in the data section, or index of the first entry of a directory.
+          std::uint64_t first;
+          /// Size of the file, or number of entries of the directory.
+          std::uint64_t size;
+        };
+
+        /// Entries of an IOVs table, as offsets in the arrays section.
+        struct table {
+          std::uint64_t size;
+          /// Array of time points.
+          std::uint64_t since;
+          /// Array of 32 bits key ids.
+          std::uint64_t key_ids;
+          /// Array of time points (same as since if the entries are sorted).
+          std::uint64_t max_since;
+        };
+
+        struct iov_table {
+          table all;
+          table reduced;
+          /// Offset in the arrays section of an array of string_ref.
+          std::uint64_t keys;
+          std::uint64_t n_keys;
+        };
+
+        static_assert( sizeof( CondDB::time_point_t ) == sizeof( std::uint64_t ), "unsupported time point type" );
+        static_assert( std::is_trivially_copyable_v<header> && sizeof( header ) % 8 == 0 );
+        static_assert( std::is_trivially_copyable_v<node> && sizeof( node ) == 40 );
+        static_assert( std::is_trivially_copyable_v<iov_table> && sizeof( iov_table ) == 80 );
+      } // namespace snapshot
+    }   // namespace details
+  }     // namespace v1
+} // namespace GitCondDB
+
+#endif // SNAPSHOT_FORMAT_H
@@ -0,0 +1,165 @@
+/*****************************************************************************\
+* (c) Copyright 2018 CERN for the benefit of the LHCb Collaboration           *
+*                                                                             *
+* This software is distributed under the terms of the Apache version 2        *
+* licence, copied verbatim in the file "COPYING".                             *
+*                                                                             *
+* In applying this licence, CERN does not waive the privileges and immunities *
+* granted to it by virtue of its status as an Intergovernmental Organization  *
+* or submit itself to any jurisdiction.                                       *
+\*****************************************************************************/
+
+#include "GitCondDB.h"
+
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+using namespace GitCondDB::v1;
+
+namespace {
+  const std::vector<CondDB::Key> keys{
+      {"v1", "changing.xml", 0},
+      {"v1", "changing.xml", 1451606400000000000},
+      {"v1", "changing.xml", 1467331200000000000},
+      {"v1", "changing.xml", 1483228800000000000},
+      {"v0", "changing.xml", 0},
+      {"HEAD", "values.xml", 0},
+      {"v0", "values.xml", 0},
+      {"v1", "Direct/Cond1", 0},
+      {"HEAD", "Direct", 0},
+  };
+
+  struct Reference {
+    std::vector<std::tuple<std::string, CondDB::IOV>> payloads;
+    std::vector<CondDB::time_point_t>                 boundaries;
+  };
+
+  Reference reference( const CondDB& db ) {
+    Reference ref;
+    for ( const auto& key : keys ) ref.payloads.emplace_back( db.get( key ) );
+    ref.boundaries = db.iov_boundaries( "v1", "changing.xml" );
+    return ref;
+  }
+
+  /// Call get and iov_boundaries from n_threads threads, counting the results that differ from the reference.
+  std::size_t hammer( const CondDB& db, const Reference& ref, std::size_t n_threads, std::size_t iterations ) {
+    std::atomic<std::size_t> errors{0};
+
+    std::vector<std::thread> threads;
+    for ( std::size_t i = 0; i < n_threads; ++i ) {
+      threads.emplace_back( [&db, &ref, &errors, iterations, i]() {
+        for ( std::size_t n = 0; n < iterations; ++n ) {
+          const auto idx                  = ( i + n ) % keys.size();
+          const auto [data, iov]          = db.get( keys[idx] );
+          const auto& [ref_data, ref_iov] = ref.payloads[idx];
+          if ( data != ref_data || iov.since != ref_iov.since || iov.until != ref_iov.until ) ++errors;
+          if ( n % 4 == 0 && db.iov_boundaries( "v1", "changing.xml" ) != ref.boundaries ) ++errors;
+        }
+      } );
+    }
+    for ( auto& t : threads ) t.join();
+
+    return errors;
+  }
+} // namespace
+
+TEST( CondDBThreads, Git ) {
+  CondDB     db  = connect( "test_data/lhcb/repo" );
+  const auto ref = reference( db );
+  ASSERT_EQ( std::get<0>( ref.payloads[3] ).substr( 0, 5 ), "<?xml" );
+
+  EXPECT_EQ( hammer( db, ref, 16, 200 ), 0 );
+  EXPECT_TRUE( db.connected() );
+
+  // the connection can be dropped while other threads are using it
+  std::atomic<bool> done{false};
+  std::thread       disconnector{[&db, &done]() {
+    while ( !done ) {
+      db.disconnect();
+      std::this_thread::yield();
+    }
+  }};
+  EXPECT_EQ( hammer( db, ref, 8, 100 ), 0 );
+  done = true;
+  disconnector.join();
+}
+
+TEST( CondDBThreads, GitCached ) {
+  CondDB     db  = connect( "test_data/lhcb/repo" );
+  const auto ref = reference( db );
+
+  db.enable_payload_cache( 4, 1024 * 1024 );
+  EXPECT_EQ( hammer( db, ref, 16, 200 ), 0 );
+  EXPECT_GT( db.payload_cache_stats().hits, 0 );
+}
+
+TEST( CondDBThreads, Filesystem ) {
+  CondDB     db  = connect( "file:test_data/lhcb/repo" );
+  const auto ref = reference( db );
+
+  EXPECT_EQ( hammer( db, ref, 16, 200 ), 0 );
+}
+
+TEST( CondDBThreads, JSON ) {
+  CondDB     db  = connect( R"(json:{
+                       "changing.xml": {
+                         "IOVs": "0 a\n1451606400000000000 b\n",
+                         "a": "data a",
+                         "b": {"IOVs": "0 ../a\n1467331200000000000 ../c\n"},
+                         "c": "data c"
+                       },
+                       "values.xml": "values",
+                       "Direct": {"Cond1": "cond"}
+                       })" );
+  const auto ref = reference( db );
+  EXPECT_EQ( ref.boundaries.size(), 3 );
+
+  EXPECT_EQ( hammer( db, ref, 16, 200 ), 0 );
+}
+
+int main( int argc, char** argv ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
+
+TEST( CondDBThreads, ParallelIOVBoundaries ) {
+  // partitions by year and by fill, with references to other partitions and entries not in order
+  std::string json = R"(json:{"Cond": {"IOVs": ")";
+  for ( int year = 0; year < 30; ++year ) json += std::to_string( year * 1000 ) + " " + std::to_string( year ) + "\\n";
+  json += R"(", )";
+  for ( int year = 0; year < 30; ++year ) {
+    json += '"' + std::to_string( year ) + R"(": {"IOVs": ")";
+    for ( int fill = 0; fill < 20; ++fill ) {
+      const int since = year * 1000 + ( ( fill == 7 ) ? 50 : fill * 40 );
+      const auto dir = ( fill % 5 == 4 ) ? "../" + std::to_string( ( year + 1 ) % 30 ) + '/' : std::string{};
+      json += std::to_string( since ) + ' ' + dir + 'f' + std::to_string( fill ) + "\\n";
+    }
+    json += R"("}, )";
+  }
+  json += R"("end": ""}})";
+
+  const std::vector<std::string>      repositories{"test_data/lhcb/repo", "file:test_data/lhcb/repo", json};
+  const std::vector<CondDB::IOV>      limits{{}, {1451606400000000000, 1467331200000000000}, {5020, 12345}};
+  const std::vector<std::string_view> paths{"changing.xml", "Cond"};
+  std::size_t n_boundaries = 0;
+  for ( const auto& repository : repositories ) {
+    for ( const auto path : paths ) {
+      for ( const auto& limit : limits ) {
+        const auto expected = connect( repository ).iov_boundaries( "v1", path, limit );
+        n_boundaries += expected.size();
+        for ( std::size_t n_threads : {2, 4, 16} ) {
+          EXPECT_EQ( connect( repository ).iov_boundaries( "v1", path, limit, n_threads ), expected )
+              << repository.substr( 0, 30 ) << ' ' << path << ' ' << n_threads;
+        }
+        // and with some of the entries already cached
+        CondDB db = connect( repository );
+        db.iov_boundaries( "v1", path, limit, 4 );
+        EXPECT_EQ( db.iov_boundaries( "v1", path, limit, 4 ), expected );
+      }
+    }
+  }
+  EXPECT_GT( n_boundaries, 600 );
+}
@@ -18,6 +18,11 @@
 
 #include "gtest/gtest.h"
 
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <numeric>
+
 using namespace GitCondDB::v1;
 
 namespace {
@@ -54,6 +59,27 @@ namespace {
 
     return xml.str();
   }
+
+  void set_live_branch( const std::string& repository, std::string_view commit );
+
+  /// Make a copy of the test repository with a branch "live" pointing to the given commit.
+  std::string make_live_repository( const std::string& name, std::string_view commit ) {
+    const std::string path = "test_data/" + name;
+    fs::remove_all( path );
+    fs::copy( "test_data/repo.git", path, fs::copy_options::recursive );
+    set_live_branch( path, commit );
+    return path;
+  }
+
+  /// Move the branch "live" of a repository (through a lock file, as Git does).
+  void set_live_branch( const std::string& repository, std::string_view commit ) {
+    const std::string ref = repository + "/refs/heads/live";
+    std::ofstream{ref + ".lock"} << commit << '\n';
+    fs::rename( ref + ".lock", ref );
+  }
+
+  constexpr std::string_view v0_commit = "a454e577ed8808a0439c02ef7152ea75fe21027f";
+  constexpr std::string_view v1_commit = "8eb8d54c0027675e26d82cbeb68c93d2ae7f63a1";
 } // namespace
 
 TEST( CondDB, Connection ) {
@@ -236,6 +262,224 @@ TEST( CondDB, GetIOVs ) {
   }
 }
 
+TEST( CondDB, IOVBoundariesModifiedFiles ) {
+  const fs::path root{"test_data/fs_iovs"};
+  fs::remove_all( root );
+  fs::create_directories( root / "Cond" );
+  for ( const auto name : {"a", "b", "c"} ) std::ofstream{( root / "Cond" / name ).string()} << name;
+  std::ofstream{( root / "Cond" / "IOVs" ).string()} << "0 a\n100 b\n";
+
+  CondDB db = connect( "file:" + root.string() );
+  EXPECT_EQ( db.iov_boundaries( "HEAD", "Cond" ), ( std::vector<CondDB::time_point_t>{0, 100} ) );
+  EXPECT_EQ( std::get<0>( db.get( {"HEAD", "Cond", 250} ) ), "b" );
+
+  // files can change without refresh(), so the boundaries must follow the payloads
+  std::ofstream{( root / "Cond" / "IOVs" ).string()} << "0 a\n100 b\n200 c\n";
+  EXPECT_EQ( std::get<0>( db.get( {"HEAD", "Cond", 250} ) ), "c" );
+  EXPECT_EQ( db.iov_boundaries( "HEAD", "Cond" ), ( std::vector<CondDB::time_point_t>{0, 100, 200} ) );
+
+  fs::remove_all( root );
+}
+
+TEST( CondDB, GetIOVsCached ) {
+  {
+    const auto path = make_live_repository( "boundaries.git", v0_commit );
+    CondDB     db   = connect( path );
+
+    const std::vector<CondDB::time_point_t> v0_expected{0, 100};
+    EXPECT_EQ( db.iov_boundaries( "live", "Cond" ), v0_expected );
+    EXPECT_EQ( db.iov_boundaries( "live", "Cond" ), v0_expected );
+
+    // the cached results are indexed by the id of the Git object, so they do not need to be invalidated
+    set_live_branch( path, v1_commit );
+    db.update();
+    const std::vector<CondDB::time_point_t> v1_expected{0, 100, 150, 200};
+    EXPECT_EQ( db.iov_boundaries( "live", "Cond" ), v1_expected );
+    EXPECT_EQ( db.iov_boundaries( "live", "Cond", {120, 180} ), ( std::vector<CondDB::time_point_t>{120, 150} ) );
+    EXPECT_EQ( db.iov_boundaries( "live", "Cond/group" ), ( std::vector<CondDB::time_point_t>{50, 150} ) );
+    EXPECT_EQ( db.iov_boundaries( "live", "Cond" ), v1_expected );
+  }
+  {
+    // entries not in order are reported as they are found
+    CondDB db = connect( R"(json:{
+                         "Cond": {
+                           "IOVs": "0 a\n100 b\n50 level1\n200 d\n",
+                           "level1": {
+                             "IOVs": "0 x\n70 y\n"
+                           }
+                         }
+                         })" );
+
+    const std::vector<CondDB::time_point_t> expected{0, 50, 70, 200};
+    const std::vector<CondDB::time_point_t> limited{60, 60, 70, 200};
+    for ( int i = 0; i < 2; ++i ) {
+      EXPECT_EQ( db.iov_boundaries( "", "Cond" ), expected );
+      EXPECT_EQ( db.iov_boundaries( "", "Cond", {60, 250} ), limited );
+      EXPECT_EQ( db.iov_boundaries( "", "Cond", {300, 400} ), ( std::vector<CondDB::time_point_t>{300} ) );
+    }
+  }
+}
+
+TEST( CondDB, PayloadDedup ) {
+  CondDB db = connect( "test_data/lhcb/repo" );
+
+  // changing.xml/2017 points to the second half of 2016
+  const auto [p2016, iov2016] = db.get_payload( {"v1", "changing.xml", 1467331200000000000} );
+  const auto [p2017, iov2017] = db.get_payload( {"v1", "changing.xml", 1483228800000000000} );
+  EXPECT_EQ( iov2016.until, iov2017.since );
+  EXPECT_EQ( p2016.data().data(), p2017.data().data() );
+
+  auto stats = db.payload_dedup_stats();
+  EXPECT_EQ( stats.lookups, 2 );
+  EXPECT_EQ( stats.hits, 1 );
+  EXPECT_EQ( stats.bytes_saved, p2016.size() );
+  EXPECT_EQ( stats.payloads, 1 );
+  EXPECT_EQ( stats.bytes, p2016.size() );
+
+  // the payloads held by the cache count as in use
+  db.enable_payload_cache( 16, 1024 * 1024 );
+  db.get_payload( {"v1", "changing.xml", 0} );
+  EXPECT_EQ( db.payload_dedup_stats().payloads, 2 );
+
+  // other backends do not share payloads
+  EXPECT_EQ( connect( "file:test_data/lhcb/repo" ).payload_dedup_stats().lookups, 0 );
+}
+
+TEST( CondDB, GetInTags ) {
+  CondDB                         db = connect( "test_data/lhcb/repo" );
+  const std::vector<std::string> tags{"v0", "v1", "HEAD", "v1"};
+
+  for ( std::size_t n_threads : {1, 4} ) {
+    // same blob in all tags
+    auto res = db.get_in_tags( tags, "changing.xml", 1467331200000000000, n_threads );
+    ASSERT_EQ( res.groups.size(), 1 );
+    EXPECT_EQ( res.groups[0].content_id, "2c628218ce8617639296de1f8089742cc056d736" );
+    EXPECT_EQ( res.groups[0].tags, ( std::vector<std::size_t>{0, 1, 2, 3} ) );
+    EXPECT_EQ( res.group_of, ( std::vector<std::size_t>{0, 0, 0, 0} ) );
+    for ( std::size_t i = 0; i < tags.size(); ++i ) {
+      const auto [data, iov] = db.get( {tags[i], "changing.xml", 1467331200000000000} );
+      EXPECT_EQ( res.groups[0].payload.data(), data );
+      EXPECT_EQ( res.iovs[i].since, iov.since ) << tags[i];
+      EXPECT_EQ( res.iovs[i].until, iov.until ) << tags[i];
+    }
+
+    // v0 differs from the others
+    res = db.get_in_tags( tags, "changing.xml", 1483228800000000000, n_threads );
+    ASSERT_EQ( res.groups.size(), 2 );
+    EXPECT_EQ( res.groups[0].content_id, "d6b8562d33c2b16eda13a9236dc51b09931f3c7b" );
+    EXPECT_EQ( res.groups[0].tags, std::vector<std::size_t>{0} );
+    EXPECT_EQ( res.groups[1].tags, ( std::vector<std::size_t>{1, 2, 3} ) );
+    EXPECT_EQ( res.group_of, ( std::vector<std::size_t>{0, 1, 1, 1} ) );
+    EXPECT_EQ( res.groups[0].payload.data(), std::get<0>( db.get( {"v0", "changing.xml", 1483228800000000000} ) ) );
+    EXPECT_EQ( res.groups[1].payload.data(), std::get<0>( db.get( {"v1", "changing.xml", 1483228800000000000} ) ) );
+    EXPECT_EQ( res.iovs[0].since, 1470002400000000000 );
+    EXPECT_EQ( res.iovs[1].since, 1483228800000000000 );
+
+    // files without IOVs
+    res = db.get_in_tags( tags, "values.xml", 0, n_threads );
+    ASSERT_EQ( res.groups.size(), 3 );
+    EXPECT_EQ( res.groups[1].tags, ( std::vector<std::size_t>{1, 3} ) );
+    EXPECT_EQ( res.group_of, ( std::vector<std::size_t>{0, 1, 2, 1} ) );
+    EXPECT_EQ( res.groups[2].payload.data(), std::get<0>( db.get( {"HEAD", "values.xml", 0} ) ) );
+
+    EXPECT_THROW( db.get_in_tags( {"v1", "no-tag"}, "values.xml", 0, n_threads ), std::runtime_error );
+    EXPECT_THROW( db.get_in_tags( tags, "no-file.xml", 0, n_threads ), std::runtime_error );
+  }
+
+  // only the requested tags are tracked for updates (v0, v1 and HEAD)
+  db.enable_metrics();
+  EXPECT_TRUE( db.update().empty() );
+  EXPECT_EQ( db.metrics()[CondDB::operation::revparse].count, 3 );
+
+  EXPECT_TRUE( db.get_in_tags( {}, "values.xml", 0 ).groups.empty() );
+
+  // other backends group by object id (each tag is distinct)
+  CondDB     fs  = connect( "file:test_data/lhcb/repo" );
+  const auto res = fs.get_in_tags( {"v1", "v1", "HEAD"}, "changing.xml", 0 );
+  ASSERT_EQ( res.groups.size(), 2 );
+  EXPECT_EQ( res.groups[0].payload.data(), std::get<0>( fs.get( {"v1", "changing.xml", 0} ) ) );
+  EXPECT_EQ( res.group_of, ( std::vector<std::size_t>{0, 0, 1} ) );
+}
+
+TEST( CondDB, ChangedPaths ) {
+  CondDB db = connect( "test_data/lhcb/repo" );
+
+  EXPECT_EQ( db.changed_paths( "v0", "v1" ), ( std::vector<std::string>{"changing.xml", "values.xml"} ) );
+  EXPECT_EQ( db.changed_paths( "v1", "v0" ), ( std::vector<std::string>{"changing.xml", "values.xml"} ) );
+  EXPECT_EQ( db.changed_paths( "v1", "HEAD" ), std::vector<std::string>{"values.xml"} );
+  EXPECT_TRUE( db.changed_paths( "v1", "v1" ).empty() );
+
+  // restricted to a directory (or to a part of a condition)
+  EXPECT_EQ( db.changed_paths( "v0", "v1", "changing.xml" ), std::vector<std::string>{"changing.xml"} );
+  EXPECT_EQ( db.changed_paths( "v0", "v1", "changing.xml/2016/" ), std::vector<std::string>{"changing.xml"} );
+  EXPECT_TRUE( db.changed_paths( "v0", "v1", "Direct" ).empty() );
+  EXPECT_TRUE( db.changed_paths( "v0", "v1", "Nothing" ).empty() );
+
+  // the trees differ, but the conditions resolve in the same way
+  EXPECT_TRUE( db.changed_paths( "v1", "v1-unused" ).empty() );
+  EXPECT_EQ( db.changed_paths( "v0", "v1-unused" ), db.changed_paths( "v0", "v1" ) );
+
+  // new partition or new entries in the IOVs files
+  EXPECT_EQ( db.changed_paths( "v0", "v1-unused", "changing.xml/2017" ), std::vector<std::string>{"changing.xml"} );
+  EXPECT_EQ( connect( "test_data/repo.git" ).changed_paths( "v0", "v1" ), std::vector<std::string>{"Cond"} );
+
+  // other backends ignore tags
+  EXPECT_TRUE( connect( "file:test_data/lhcb/repo" ).changed_paths( "v0", "v1" ).empty() );
+}
+
+TEST( CondDB, Timeline ) {
+  {
+    CondDB     db       = connect( "test_data/repo.git" );
+    const auto timeline = db.iov_timeline( "v1", "Cond", {}, true );
+    ASSERT_EQ( timeline.size(), 4 );
+    const std::vector<std::string>          ids{"v1:Cond/v0", "v1:Cond/v1", "v1:Cond/v2", "v1:Cond/v3"};
+    const std::vector<CondDB::time_point_t> since{0, 100, 150, 200};
+    for ( std::size_t i = 0; i < timeline.size(); ++i ) {
+      EXPECT_EQ( timeline[i].iov.since, since[i] );
+      EXPECT_EQ( timeline[i].iov.until, ( i + 1 < since.size() ) ? since[i + 1] : CondDB::IOV::max() );
+      EXPECT_EQ( timeline[i].object_id, ids[i] );
+      EXPECT_EQ( timeline[i].content_id.size(), 40 );
+      EXPECT_EQ( timeline[i].payload.str(), "data " + std::to_string( i ) );
+    }
+    EXPECT_EQ( db.iov_boundaries( "v1", "Cond" ), since );
+
+    const auto limited = db.iov_timeline( "v1", "Cond", {120, 180} );
+    ASSERT_EQ( limited.size(), 2 );
+    EXPECT_EQ( limited[0].iov.since, 120 );
+    EXPECT_EQ( limited[0].iov.until, 150 );
+    EXPECT_EQ( limited[0].object_id, "v1:Cond/v1" );
+    EXPECT_EQ( limited[1].iov.since, 150 );
+    EXPECT_EQ( limited[1].iov.until, 180 );
+    EXPECT_EQ( limited[1].object_id, "v1:Cond/v2" );
+    EXPECT_TRUE( limited[0].payload.empty() );
+
+    EXPECT_TRUE( db.iov_timeline( "v1", "NotThere" ).empty() );
+  }
+  {
+    // identical payloads are read once
+    CondDB     db       = connect( "test_data/lhcb/repo" );
+    const auto timeline = db.iov_timeline( "v1", "changing.xml", {}, true );
+    ASSERT_EQ( timeline.size(), 4 );
+    EXPECT_EQ( timeline[0].object_id, "v1:changing.xml/initial/v0" );
+    EXPECT_EQ( timeline[1].object_id, "v1:changing.xml/initial/v0" );
+    EXPECT_EQ( timeline[2].object_id, "v1:changing.xml/2016/v1" );
+    EXPECT_EQ( timeline[3].object_id, "v1:changing.xml/2016/v1" );
+    EXPECT_EQ( timeline[1].payload.data().data(), timeline[0].payload.data().data() );
+    EXPECT_EQ( timeline[3].payload.data().data(), timeline[2].payload.data().data() );
+    EXPECT_NE( timeline[0].content_id, timeline[2].content_id );
+    for ( const auto& entry : timeline ) {
+      EXPECT_EQ( entry.payload.str(), std::get<0>( db.get( {"v1", "changing.xml", entry.iov.since} ) ) );
+    }
+  }
+  {
+    CondDB     db       = connect( "json:test_data/json/repo.json" );
+    const auto timeline = db.iov_timeline( "v1", "Cond", {}, true );
+    ASSERT_EQ( timeline.size(), 4 );
+    EXPECT_EQ( timeline[3].content_id, "v1:Cond/v3" );
+    EXPECT_EQ( timeline[3].payload.str(), "data 3" );
+  }
+}
+
 TEST( CondDB, Directory_FS ) {
   CondDB db = connect( "file:test_data/lhcb/repo" );
 
@@ -453,6 +697,458 @@ TEST( CondDB, IOVReduction ) {
   }
 }
 
+TEST( CondDB, PayloadCache ) {
+  CondDB db = connect( R"(json:
+                       {"Cond": {"IOVs": "0 v0\n100 group\n200 v2\n",
+                                 "v0": "data 0",
+                                 "v1": "data 1",
+                                 "v2": "data 2",
+                                 "group": {"IOVs": "50 ../v1\n150 ../v0"}},
+                        "Plain": "plain data"}
+                       )" );
+
+  EXPECT_FALSE( db.payload_cache_enabled() );
+  db.enable_payload_cache( 2, 1024 );
+  EXPECT_TRUE( db.payload_cache_enabled() );
+
+  {
+    auto [data, iov] = db.get( {"HEAD", "Cond", 110} );
+    EXPECT_EQ( data, "data 1" );
+    EXPECT_EQ( iov.since, 100 );
+    EXPECT_EQ( iov.until, 150 );
+    auto stats = db.payload_cache_stats();
+    EXPECT_EQ( stats.hits, 0 );
+    EXPECT_EQ( stats.misses, 1 );
+    EXPECT_EQ( stats.entries, 1 );
+  }
+  {
+    auto [data, iov] = db.get( {"HEAD", "Cond", 120} );
+    EXPECT_EQ( data, "data 1" );
+    EXPECT_EQ( iov.since, 100 );
+    EXPECT_EQ( iov.until, 150 );
+    EXPECT_EQ( db.payload_cache_stats().hits, 1 );
+  }
+  {
+    // bounds are applied to cached entries as for non cached ones
+    auto [data, iov] = db.get( {"HEAD", "Cond", 120}, {110, 140} );
+    EXPECT_EQ( data, "data 1" );
+    EXPECT_EQ( iov.since, 110 );
+    EXPECT_EQ( iov.until, 140 );
+    EXPECT_EQ( db.payload_cache_stats().hits, 2 );
+  }
+  {
+    auto [data, iov] = db.get( {"HEAD", "Cond", 120}, {0, 100} );
+    EXPECT_FALSE( iov.valid() );
+    EXPECT_EQ( data, "" );
+  }
+  {
+    auto [data, iov] = db.get( {"HEAD", "Plain", 120}, {110, 140} );
+    EXPECT_EQ( data, "plain data" );
+    EXPECT_EQ( iov.since, 110 );
+    EXPECT_EQ( iov.until, 140 );
+  }
+  {
+    auto [data, iov] = db.get( {"HEAD", "Plain", 500} );
+    EXPECT_EQ( data, "plain data" );
+    EXPECT_EQ( iov.since, CondDB::IOV::min() );
+    EXPECT_EQ( iov.until, CondDB::IOV::max() );
+    auto stats = db.payload_cache_stats();
+    EXPECT_EQ( stats.hits, 4 );
+    EXPECT_EQ( stats.misses, 2 );
+    EXPECT_EQ( stats.entries, 2 );
+    EXPECT_EQ( stats.evictions, 0 );
+  }
+  {
+    // the least recently used entry ("Cond" at 100-150) is evicted
+    auto [data, iov] = db.get( {"HEAD", "Cond", 10} );
+    EXPECT_EQ( data, "data 0" );
+    EXPECT_EQ( iov.since, 0 );
+    EXPECT_EQ( iov.until, 100 );
+    auto stats = db.payload_cache_stats();
+    EXPECT_EQ( stats.misses, 3 );
+    EXPECT_EQ( stats.entries, 2 );
+    EXPECT_EQ( stats.evictions, 1 );
+  }
+  {
+    auto [data, iov] = db.get( {"HEAD", "Cond", 120} );
+    EXPECT_EQ( data, "data 1" );
+    EXPECT_EQ( db.payload_cache_stats().misses, 4 );
+  }
+
+  // changing the IOV reduction invalidates the cache
+  db.set_iov_reduction( false );
+  EXPECT_EQ( db.payload_cache_stats().entries, 0 );
+
+  db.get( {"HEAD", "Cond", 120} );
+  EXPECT_EQ( db.payload_cache_stats().entries, 1 );
+  db.refresh();
+  EXPECT_EQ( db.payload_cache_stats().entries, 0 );
+
+  db.clear_payload_cache();
+  db.disable_payload_cache();
+  EXPECT_FALSE( db.payload_cache_enabled() );
+  EXPECT_EQ( db.payload_cache_stats().hits, 0 );
+}
+
+TEST( CondDB, PayloadCacheLimits ) {
+  CondDB db = connect( "test_data/repo" );
+
+  // payloads bigger than the cache are not stored
+  db.enable_payload_cache( 10, 8 );
+  EXPECT_EQ( std::get<0>( db.get( {"v1", "Cond", 0} ) ), "data 0" );
+  EXPECT_EQ( db.payload_cache_stats().entries, 0 );
+
+  db.enable_payload_cache( 10, 32 );
+  for ( CondDB::time_point_t t : {0, 110, 150, 210} ) db.get( {"v1", "Cond", t} );
+  auto stats = db.payload_cache_stats();
+  EXPECT_LE( stats.bytes, 32 );
+  EXPECT_EQ( stats.entries, 2 );
+  EXPECT_EQ( stats.evictions, 2 );
+
+  // directory listings are not cached
+  db.get( {"v1", "TheDir", 0} );
+  EXPECT_EQ( db.payload_cache_stats().misses, 5 );
+  db.get( {"v1", "TheDir", 0} );
+  EXPECT_EQ( db.payload_cache_stats().misses, 6 );
+}
+
+TEST( CondDB, GetMany ) {
+  const std::vector<CondDB::Key> keys{{"v1", "Cond", 0},   {"v1", "Cond", 110}, {"v0", "Cond", 110},
+                                      {"v1", "Cond", 150}, {"v1", "Cond", 0},   {"HEAD", "TheDir/TheFile.txt", 0},
+                                      {"v1", "Cond", 210}, {"v1", "TheDir", 0}, {"v0", "Cond", 110}};
+
+  for ( const auto& repository : {"test_data/repo.git", "file:test_data/repo", "json:test_data/json/repo.json"} ) {
+    CondDB db = connect( repository );
+
+    for ( const CondDB::IOV& bounds : {CondDB::IOV{}, CondDB::IOV{100, 200}} ) {
+      for ( std::size_t n_threads : {1, 4, 100} ) {
+        const auto results = db.get_many( keys, bounds, n_threads );
+        ASSERT_EQ( results.size(), keys.size() );
+        for ( std::size_t i = 0; i < keys.size(); ++i ) {
+          const auto [data, iov]              = results[i];
+          const auto [expected, expected_iov] = db.get( keys[i], bounds );
+          EXPECT_EQ( data, expected ) << repository << " " << keys[i].tag << ":" << keys[i].path;
+          EXPECT_EQ( iov.since, expected_iov.since );
+          EXPECT_EQ( iov.until, expected_iov.until );
+        }
+      }
+    }
+    EXPECT_TRUE( db.get_many( {} ).empty() );
+  }
+
+  {
+    CondDB db = connect( "test_data/repo.git" );
+    EXPECT_EQ( std::get<0>( db.get_many( keys )[1] ), "data 1" );
+
+    // payloads found with get_many are cached as if found with get
+    db.enable_payload_cache( 100, 1024 );
+    db.get_many( keys, 2 );
+    const auto misses = db.payload_cache_stats().misses;
+    EXPECT_EQ( std::get<0>( db.get( {"v1", "Cond", 120} ) ), "data 1" );
+    EXPECT_EQ( db.payload_cache_stats().misses, misses );
+
+    try {
+      db.get_many( {{"v1", "Cond", 0}, {"v1", "NoCond", 0}}, 2 );
+      FAIL() << "exception expected for invalid path";
+    } catch ( std::runtime_error& err ) {
+      // the error refers to the requested tag
+      EXPECT_EQ( std::string_view{err.what()}.substr( 0, 31 ), "cannot resolve object v1:NoCond" );
+    }
+
+    // only the requested tags are tracked for updates (v0, v1 and HEAD)
+    db.enable_metrics();
+    EXPECT_TRUE( db.update().empty() );
+    EXPECT_EQ( db.metrics()[CondDB::operation::revparse].count, 3 );
+  }
+}
+
+TEST( CondDB, Async ) {
+  const std::vector<CondDB::Key> keys{{"v1", "Cond", 0},
+                                      {"v1", "Cond", 110},
+                                      {"v0", "Cond", 110},
+                                      {"HEAD", "TheDir/TheFile.txt", 0},
+                                      {"v1", "TheDir", 0}};
+
+  for ( const auto& repository : {"test_data/repo.git", "file:test_data/repo", "json:test_data/json/repo.json"} ) {
+    CondDB db = connect( repository );
+    EXPECT_EQ( db.async_threads(), 2 );
+
+    std::vector<std::future<std::tuple<std::string, CondDB::IOV>>> futures;
+    for ( const auto& key : keys ) futures.emplace_back( db.get_async( key, {100, 200} ) );
+    for ( std::size_t i = 0; i < keys.size(); ++i ) {
+      const auto [data, iov]              = futures[i].get();
+      const auto [expected, expected_iov] = db.get( keys[i], {100, 200} );
+      EXPECT_EQ( data, expected ) << repository << " " << keys[i].tag << ":" << keys[i].path;
+      EXPECT_EQ( iov.since, expected_iov.since );
+      EXPECT_EQ( iov.until, expected_iov.until );
+    }
+  }
+
+  {
+    CondDB db = connect( "test_data/repo.git" );
+    db.set_async_threads( 4 );
+    EXPECT_EQ( db.async_threads(), 4 );
+    db.set_async_threads( 0 );
+    EXPECT_EQ( db.async_threads(), 1 );
+
+    auto nothing = db.prefetch( "v1", {}, 0 );
+    EXPECT_EQ( nothing.wait_for( std::chrono::seconds( 0 ) ), std::future_status::ready );
+
+    // prefetched payloads are served from the cache
+    db.enable_payload_cache( 100, 1024 );
+    db.prefetch( "v1", {"Cond", "TheDir/TheFile.txt", "TheDir"}, 110 ).get();
+    const auto misses = db.payload_cache_stats().misses;
+    EXPECT_EQ( misses, 3 );
+    EXPECT_EQ( std::get<0>( db.get( {"v1", "Cond", 120} ) ), "data 1" );
+    EXPECT_EQ( std::get<0>( db.get( {"v1", "TheDir/TheFile.txt", 0} ) ), "some data\n" );
+    EXPECT_EQ( db.payload_cache_stats().misses, misses );
+
+    try {
+      db.prefetch( "v1", {"Cond", "NoCond"}, 0 ).get();
+      FAIL() << "exception expected for invalid path";
+    } catch ( std::runtime_error& err ) {
+      EXPECT_EQ( std::string_view{err.what()}.substr( 0, 22 ), "cannot resolve object " );
+    }
+
+    try {
+      db.get_async( {"v1", "NoCond", 0} ).get();
+      FAIL() << "exception expected for invalid path";
+    } catch ( std::runtime_error& err ) {
+      EXPECT_EQ( std::string_view{err.what()}.substr( 0, 22 ), "cannot resolve object " );
+    }
+  }
+}
+
+TEST( CondDB, GetPayload ) {
+  const std::vector<CondDB::Key> keys{{"v1", "Cond", 110},
+                                      {"v1", "Cond", 150},
+                                      {"HEAD", "TheDir/TheFile.txt", 0},
+                                      {"v1", "TheDir", 0},
+                                      {"v1", "Cond", 0}};
+
+  for ( const auto& repository : {"test_data/repo.git", "file:test_data/repo", "json:test_data/json/repo.json"} ) {
+    std::vector<std::tuple<CondDB::Payload, CondDB::IOV>> payloads;
+    {
+      CondDB db = connect( repository );
+      for ( const auto& key : keys ) {
+        payloads.emplace_back( db.get_payload( key, {100, 200} ) );
+        const auto [expected, expected_iov] = db.get( key, {100, 200} );
+        const auto& [data, iov]             = payloads.back();
+        EXPECT_EQ( data.data(), expected ) << repository << " " << key.tag << ":" << key.path;
+        EXPECT_EQ( data.size(), expected.size() );
+        EXPECT_EQ( iov.since, expected_iov.since );
+        EXPECT_EQ( iov.until, expected_iov.until );
+      }
+    }
+    // the data is still accessible after the database is gone
+    EXPECT_EQ( std::get<0>( payloads[0] ).str(), "data 1" );
+    EXPECT_EQ( std::get<0>( payloads[1] ).data(), "data 2" );
+    EXPECT_TRUE( std::get<0>( payloads[4] ).empty() );
+  }
+
+  {
+    CondDB db = connect( "test_data/repo.git" );
+    db.enable_payload_cache( 10, 1024 );
+    // cached payloads are shared, not copied
+    const auto [first, first_iov]   = db.get_payload( {"v1", "Cond", 100} );
+    const auto [second, second_iov] = db.get_payload( {"v1", "Cond", 120} );
+    EXPECT_EQ( first.data().data(), second.data().data() );
+    EXPECT_EQ( std::string_view{second}, "data 1" );
+
+    const CondDB::Payload empty;
+    EXPECT_TRUE( empty.empty() );
+    EXPECT_EQ( empty.str(), "" );
+  }
+}
+
+TEST( CondDB, Metrics ) {
+  using op = CondDB::operation;
+
+  CondDB db = connect( "test_data/repo.git" );
+  EXPECT_FALSE( db.metrics_enabled() );
+  db.get( {"v1", "Cond", 0} );
+  EXPECT_EQ( db.metrics().backend, "git" );
+  EXPECT_EQ( db.metrics()[op::get].count, 0 );
+
+  db.enable_metrics();
+  EXPECT_TRUE( db.metrics_enabled() );
+  db.disconnect(); // forget the resolved tags
+  db.get( {"v1", "Cond", 0} );
+  db.get( {"v1", "TheDir", 0} );
+  db.iov_boundaries( "v1", "Cond" );
+
+  // Cond/IOVs was already parsed (and cached) before enabling the metrics
+  auto metrics = db.metrics();
+  EXPECT_EQ( metrics[op::get].count, 3 );
+  EXPECT_EQ( metrics[op::revparse].count, 1 );
+  EXPECT_GT( metrics[op::exists].count, 0 );
+  EXPECT_EQ( metrics[op::iov_parse].count, 1 );
+  EXPECT_EQ( metrics[op::blob_read].count, 2 );
+  EXPECT_EQ( metrics[op::dir_conversion].count, 1 );
+  for ( const auto& stats : metrics.operations ) {
+    EXPECT_EQ( std::accumulate( begin( stats.latency_histogram ), end( stats.latency_histogram ), std::uint64_t{0} ),
+               stats.count );
+    EXPECT_LE( stats.max_ns, stats.total_ns );
+  }
+  EXPECT_GT( metrics[op::get].total_ns, 0 );
+
+  db.reset_metrics();
+  EXPECT_EQ( db.metrics()[op::get].count, 0 );
+  EXPECT_EQ( db.metrics()[op::get].total_ns, 0 );
+
+  db.enable_metrics( false );
+  db.get( {"v1", "Cond", 0} );
+  EXPECT_EQ( db.metrics()[op::get].count, 0 );
+
+  EXPECT_EQ( CondDB::operation_name( op::iov_parse ), "iov_parse" );
+
+  {
+    CondDB db = connect( "file:test_data/repo" );
+    db.enable_metrics();
+    db.get( {"v1", "Cond", 0} );
+    metrics = db.metrics();
+    EXPECT_EQ( metrics.backend, "filesystem" );
+    EXPECT_EQ( metrics[op::get].count, 3 );
+    EXPECT_EQ( metrics[op::iov_parse].count, 1 );
+    EXPECT_EQ( metrics[op::blob_read].count, 2 );
+  }
+  {
+    CondDB db = connect( "json:test_data/json/repo.json" );
+    db.enable_metrics();
+    db.get( {"v1", "Cond", 0} );
+    metrics = db.metrics();
+    EXPECT_EQ( metrics.backend, "json" );
+    EXPECT_EQ( metrics[op::get].count, 3 );
+    EXPECT_EQ( metrics[op::blob_read].count, 0 );
+  }
+}
+
+TEST( CondDB, Update ) {
+  const auto path = make_live_repository( "live.git", v0_commit );
+  CondDB     db   = connect( path );
+  db.enable_payload_cache( 100, 1024 * 1024 );
+
+  EXPECT_EQ( std::get<0>( db.get( {"live", "Cond", 10} ) ), "data 0" );
+  EXPECT_EQ( std::get<0>( db.get( {"live", "Cond", 150} ) ), "data 1" );
+  EXPECT_EQ( std::get<0>( db.get( {"live", "Cond/v0", 0} ) ), "data 0" );
+  EXPECT_EQ( std::get<0>( db.get( {"live", "TheDir/TheFile.txt", 0} ) ), "some data\n" );
+  EXPECT_EQ( db.payload_cache_stats().entries, 4 );
+
+  // nothing changed
+  EXPECT_TRUE( db.update().empty() );
+  EXPECT_EQ( db.payload_cache_stats().entries, 4 );
+
+  set_live_branch( path, v1_commit );
+
+  auto changes = db.update();
+  std::sort( begin( changes ), end( changes ) );
+  const std::vector<std::string> expected{"live:Cond/IOVs", "live:Cond/group/IOVs", "live:Cond/v2", "live:Cond/v3"};
+  EXPECT_EQ( changes, expected );
+
+  // only the entries resolved through the IOVs files are dropped
+  EXPECT_EQ( db.payload_cache_stats().entries, 2 );
+  const auto hits = db.payload_cache_stats().hits;
+  EXPECT_EQ( std::get<0>( db.get( {"live", "Cond/v0", 0} ) ), "data 0" );
+  EXPECT_EQ( std::get<0>( db.get( {"live", "TheDir/TheFile.txt", 0} ) ), "some data\n" );
+  EXPECT_EQ( db.payload_cache_stats().hits, hits + 2 );
+
+  EXPECT_EQ( std::get<0>( db.get( {"live", "Cond", 10} ) ), "data 0" );
+  EXPECT_EQ( std::get<0>( db.get( {"live", "Cond", 160} ) ), "data 2" );
+  EXPECT_EQ( std::get<0>( db.get( {"live", "Cond", 210} ) ), "data 3" );
+
+  EXPECT_TRUE( db.update().empty() );
+
+  // other backends do not change
+  CondDB json_db = connect( "json:{\"Cond\": \"data\"}" );
+  EXPECT_TRUE( json_db.update().empty() );
+  EXPECT_THROW( json_db.watch( []( const std::vector<std::string>& ) {} ), std::runtime_error );
+}
+
+TEST( CondDB, Watch ) {
+  const auto path = make_live_repository( "watched.git", v0_commit );
+  CondDB     db   = connect( path );
+  db.enable_payload_cache( 100, 1024 * 1024 );
+  EXPECT_EQ( std::get<0>( db.get( {"live", "Cond", 210} ) ), "data 1" );
+
+  std::mutex               mutex;
+  std::condition_variable  cv;
+  std::vector<std::string> changes;
+  db.watch( [&]( const std::vector<std::string>& c ) {
+    std::lock_guard<std::mutex> guard( mutex );
+    changes = c;
+    cv.notify_all();
+  } );
+  EXPECT_TRUE( db.watching() );
+
+  set_live_branch( path, v1_commit );
+  {
+    std::unique_lock<std::mutex> lock( mutex );
+    ASSERT_TRUE( cv.wait_for( lock, std::chrono::seconds{10}, [&changes]() { return !changes.empty(); } ) );
+    EXPECT_EQ( changes.size(), 4 );
+  }
+  EXPECT_EQ( std::get<0>( db.get( {"live", "Cond", 210} ) ), "data 3" );
+
+  db.stop_watching();
+  EXPECT_FALSE( db.watching() );
+}
+
+TEST( CondDB, WatchNestedRefs ) {
+  const auto path = make_live_repository( "watched_nested.git", v0_commit );
+  fs::create_directories( path + "/refs/tags/release" );
+  const std::string ref = path + "/refs/tags/release/live";
+  std::ofstream{ref} << v0_commit << '\n';
+
+  CondDB db = connect( path );
+  EXPECT_EQ( std::get<0>( db.get( {"release/live", "Cond", 210} ) ), "data 1" );
+
+  std::mutex               mutex;
+  std::condition_variable  cv;
+  std::vector<std::string> changes;
+  db.watch( [&]( const std::vector<std::string>& c ) {
+    std::lock_guard<std::mutex> guard( mutex );
+    changes = c;
+    cv.notify_all();
+  } );
+
+  std::ofstream{ref + ".lock"} << v1_commit << '\n';
+  fs::rename( ref + ".lock", ref );
+  {
+    std::unique_lock<std::mutex> lock( mutex );
+    ASSERT_TRUE( cv.wait_for( lock, std::chrono::seconds{10}, [&changes]() { return !changes.empty(); } ) );
+  }
+  EXPECT_EQ( std::get<0>( db.get( {"release/live", "Cond", 210} ) ), "data 3" );
+}
+
+TEST( Watcher, Subdirectories ) {
+  const fs::path root{"test_data/watched_dir"};
+  fs::remove_all( root );
+  fs::create_directories( root / "a" / "b" );
+
+  std::mutex              mutex;
+  std::condition_variable cv;
+  int                     calls  = 0;
+  auto                    action = [&]() {
+    std::lock_guard<std::mutex> guard( mutex );
+    ++calls;
+    cv.notify_all();
+  };
+  auto wait_calls = [&]( int n ) {
+    std::unique_lock<std::mutex> lock( mutex );
+    return cv.wait_for( lock, std::chrono::seconds{10}, [&]() { return calls >= n; } );
+  };
+  details::Watcher watcher{{{root.string(), true}}, action};
+
+  // existing subdirectories
+  std::ofstream{( root / "a" / "b" / "x" ).string()} << "x";
+  ASSERT_TRUE( wait_calls( 1 ) );
+
+  // subdirectories created after the start
+  fs::create_directories( root / "c" );
+  ASSERT_TRUE( wait_calls( 2 ) );
+  std::ofstream{( root / "c" / "y" ).string()} << "y";
+  ASSERT_TRUE( wait_calls( 3 ) );
+}
+
 int main( int argc, char** argv ) {
   ::testing::InitGoogleTest( &argc, argv );
   return RUN_ALL_TESTS();
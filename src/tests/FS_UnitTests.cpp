@@ -18,6 +18,9 @@
 
 #include "gtest/gtest.h"
 
+#include <algorithm>
+#include <fstream>
+
 using namespace GitCondDB::v1;
 
 TEST( FSImpl, Connection ) {
@@ -95,6 +98,73 @@ TEST( FSImpl, Access ) {
   EXPECT_EQ( db.commit_time( "HEAD" ), std::chrono::time_point<std::chrono::system_clock>::max() );
 }
 
+TEST( FSImpl, Lookup ) {
+  details::FilesystemImpl db{"test_data/repo"};
+
+  {
+    auto data = db.lookup( "HEAD:Cond" );
+    ASSERT_EQ( data.index(), 1 );
+    const auto& dir = std::get<1>( data );
+    ASSERT_TRUE( dir.iovs );
+    EXPECT_EQ( dir.iovs->key( 1 ), "group" );
+  }
+  {
+    auto data = db.lookup( "HEAD:" );
+    ASSERT_EQ( data.index(), 1 );
+    auto content = std::get<1>( data ).content;
+    std::sort( begin( content.dirs ), end( content.dirs ) );
+    EXPECT_EQ( content.files, std::vector<std::string>{"Cond"} );
+    EXPECT_EQ( content.dirs, ( std::vector<std::string>{".git", "TheDir"} ) );
+  }
+  EXPECT_EQ( std::get<0>( db.lookup( "HEAD:Cond/v1" ) ).data(), "data 1" );
+
+  EXPECT_TRUE( db.find_iovs( "HEAD:Cond/group" ) );
+  EXPECT_FALSE( db.find_iovs( "HEAD:TheDir" ) );
+  EXPECT_FALSE( db.find_iovs( "HEAD:Cond/v1" ) );
+}
+
+TEST( FSImpl, Diff ) {
+  details::FilesystemImpl db{"test_data/repo"};
+
+  // tags are ignored by the backend
+  EXPECT_TRUE( db.diff( "v0:", "v1:" ).empty() );
+  EXPECT_TRUE( db.diff( "v0:Cond", "v1:Cond" ).empty() );
+  EXPECT_TRUE( db.diff( "v0:Nothing", "v1:Nothing" ).empty() );
+
+  // the generic implementation compares the content of any two entries
+  EXPECT_EQ( db.diff( "v0:Cond/v0", "v0:Cond/v1" ), std::vector<std::string>{"Cond/v1"} );
+  EXPECT_EQ( db.diff( "v0:Cond/v0", "v0:Nothing" ), std::vector<std::string>{"Nothing"} );
+  EXPECT_EQ( db.diff( "v0:Cond/v0", "v0:TheDir" ), std::vector<std::string>{"TheDir"} );
+  EXPECT_EQ( db.diff( "v0:Cond/group", "v0:TheDir" ),
+             ( std::vector<std::string>{"TheDir/IOVs", "TheDir/TheFile.txt"} ) );
+}
+
+TEST( FSImpl, Cache ) {
+  const fs::path root{"test_data/fs_cache"};
+  fs::remove_all( root );
+  fs::create_directories( root / "Dir" );
+  std::ofstream{( root / "Dir" / "small.txt" ).string()} << "small";
+  const std::string large( details::FilesystemImpl::mmap_threshold + 10, 'x' );
+  std::ofstream{( root / "Dir" / "large.txt" ).string()} << large;
+
+  details::FilesystemImpl db{root.string()};
+  EXPECT_EQ( std::get<0>( db.get( "HEAD:Dir/small.txt" ) ), "small" );
+  EXPECT_EQ( std::get<0>( db.get( "HEAD:Dir/large.txt" ) ), large );
+  EXPECT_FALSE( db.exists( "HEAD:Dir/new.txt" ) );
+  EXPECT_TRUE( db.exists( "HEAD:Dir/." ) );
+  EXPECT_TRUE( db.exists( "HEAD:Dir/" ) );
+
+  // directory listings are cached until refresh
+  std::ofstream{( root / "Dir" / "new.txt" ).string()} << "new";
+  EXPECT_FALSE( db.exists( "HEAD:Dir/new.txt" ) );
+  EXPECT_EQ( std::get<1>( db.get( "HEAD:Dir" ) ).files, ( std::vector<std::string>{"large.txt", "small.txt"} ) );
+  db.refresh();
+  EXPECT_TRUE( db.exists( "HEAD:Dir/new.txt" ) );
+  EXPECT_EQ( std::get<0>( db.get( "HEAD:Dir/new.txt" ) ), "new" );
+  EXPECT_EQ( std::get<1>( db.get( "HEAD:Dir" ) ).files,
+             ( std::vector<std::string>{"large.txt", "new.txt", "small.txt"} ) );
+}
+
 int main( int argc, char** argv ) {
   ::testing::InitGoogleTest( &argc, argv );
   return RUN_ALL_TESTS();
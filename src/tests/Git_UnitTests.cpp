@@ -105,6 +105,327 @@ TEST( GitImpl, FailAccess ) {
 
 TEST( GitImpl, AccessBare ) { access_test( details::GitImpl{"test_data/repo.git"} ); }
 
+TEST( GitImpl, IOVsCache ) {
+  details::GitImpl db{"test_data/repo.git"};
+
+  auto iovs = db.get_iovs( "v1:Cond/IOVs" );
+  ASSERT_TRUE( iovs );
+  EXPECT_EQ( iovs->size(), 3 );
+  EXPECT_EQ( iovs->key( 1 ), "group" );
+
+  // same blob from a different tag
+  EXPECT_EQ( db.get_iovs( "HEAD:Cond/IOVs" ), iovs );
+  EXPECT_NE( db.get_iovs( "v0:Cond/IOVs" ), iovs );
+
+  try {
+    db.get_iovs( "HEAD:Cond" );
+    FAIL() << "exception expected for invalid IOVs object";
+  } catch ( std::runtime_error& err ) {
+    EXPECT_EQ( std::string_view{err.what()}, "invalid IOVs object HEAD:Cond" );
+  }
+}
+
+TEST( GitImpl, Paths ) {
+  details::GitImpl db{"test_data/repo.git"};
+
+  EXPECT_TRUE( db.exists( "HEAD:" ) );
+  EXPECT_TRUE( db.exists( "HEAD:TheDir/" ) );
+  EXPECT_TRUE( db.exists( "HEAD:Cond/group/IOVs" ) );
+  EXPECT_FALSE( db.exists( "HEAD:TheDir//TheFile.txt" ) );
+  EXPECT_FALSE( db.exists( "HEAD:TheDir/TheFile.txt/" ) );
+  EXPECT_FALSE( db.exists( "HEAD:TheDir/TheFile.txt/More" ) );
+  EXPECT_FALSE( db.exists( "NoTag:TheDir" ) );
+  EXPECT_EQ( std::get<1>( db.get( "HEAD:TheDir/" ) ).files, std::vector<std::string>{"TheFile.txt"} );
+
+  // tags can be any revision
+  EXPECT_EQ( std::get<0>( db.get( "v1~1:Cond/v1" ) ), "data 1" );
+  EXPECT_FALSE( db.exists( "v1~1:Cond/v2" ) );
+
+  try {
+    db.get( "NoTag:TheDir" );
+    FAIL() << "exception expected for invalid tag";
+  } catch ( std::runtime_error& err ) {
+    EXPECT_EQ( std::string_view{err.what()}.substr( 0, 34 ), "cannot resolve object NoTag:TheDir" );
+  }
+}
+
+TEST( GitImpl, TagPinning ) {
+  const fs::path repo_path{"test_data/pinning.git"};
+  fs::remove_all( repo_path );
+  fs::copy( "test_data/repo.git", repo_path, fs::copy_options::recursive );
+
+  details::GitImpl db{repo_path.string()};
+  EXPECT_TRUE( db.exists( "v1:Cond/v3" ) );
+
+  // move the tag v1 to v0
+  {
+    git_repository* repo = nullptr;
+    git_object*     obj  = nullptr;
+    ASSERT_EQ( git_repository_open( &repo, repo_path.c_str() ), 0 );
+    ASSERT_EQ( git_revparse_single( &obj, repo, "v0^{commit}" ), 0 );
+    char oid[GIT_OID_HEXSZ + 1];
+    std::ofstream{repo_path / "refs" / "tags" / "v1"} << git_oid_tostr( oid, sizeof( oid ), git_object_id( obj ) )
+                                                      << '\n';
+    git_object_free( obj );
+    git_repository_free( repo );
+  }
+
+  // the tag is still pointing to the old tree
+  EXPECT_TRUE( db.exists( "v1:Cond/v3" ) );
+  EXPECT_EQ( std::get<0>( db.get( "v1:Cond/v3" ) ), "data 3" );
+
+  db.refresh();
+  EXPECT_FALSE( db.exists( "v1:Cond/v3" ) );
+
+  fs::remove_all( repo_path );
+}
+
+TEST( GitImpl, FullObjectIds ) {
+  details::GitImpl db{"test_data/repo.git"};
+
+  std::string commit_id;
+  {
+    git_repository* repo = nullptr;
+    git_object*     obj  = nullptr;
+    ASSERT_EQ( git_repository_open( &repo, "test_data/repo.git" ), 0 );
+    ASSERT_EQ( git_revparse_single( &obj, repo, "v1^{commit}" ), 0 );
+    char oid[GIT_OID_HEXSZ + 1];
+    commit_id = git_oid_tostr( oid, sizeof( oid ), git_object_id( obj ) );
+    git_object_free( obj );
+    git_repository_free( repo );
+  }
+
+  db.metrics().enable( true );
+  const auto revparse_count = [&db]() { return db.metrics().snapshot( "git" )[CondDB::operation::revparse].count; };
+
+  // a commit id is resolved only once, and it is not checked again by update()
+  for ( int i = 0; i < 10; ++i ) EXPECT_EQ( std::get<0>( db.get( ( commit_id + ":Cond/v1" ).c_str() ) ), "data 1" );
+  EXPECT_EQ( revparse_count(), 1 );
+  EXPECT_TRUE( db.update().empty() );
+  EXPECT_EQ( revparse_count(), 1 );
+
+  // a tree id is used directly
+  const auto tree_id = db.resolve_tag( commit_id.c_str() );
+  EXPECT_NE( tree_id, commit_id );
+  EXPECT_EQ( std::get<0>( db.get( ( tree_id + ":Cond/v1" ).c_str() ) ), "data 1" );
+  EXPECT_EQ( revparse_count(), 1 );
+}
+
+TEST( GitImpl, Lookup ) {
+  details::GitImpl db{"test_data/repo.git"};
+
+  {
+    auto data = db.lookup( "v1:Cond" );
+    ASSERT_EQ( data.index(), 1 );
+    const auto& dir = std::get<1>( data );
+    ASSERT_TRUE( dir.iovs );
+    EXPECT_EQ( dir.iovs, db.get_iovs( "v1:Cond/IOVs" ) );
+    EXPECT_EQ( dir.iovs->key( 1 ), "group" );
+  }
+  {
+    // directories with an IOVs file are listed as files
+    auto data = db.lookup( "v1:" );
+    ASSERT_EQ( data.index(), 1 );
+    const auto& dir = std::get<1>( data );
+    EXPECT_FALSE( dir.iovs );
+    EXPECT_EQ( dir.content.root, "" );
+    EXPECT_EQ( dir.content.files, std::vector<std::string>{"Cond"} );
+    EXPECT_EQ( dir.content.dirs, std::vector<std::string>{"TheDir"} );
+  }
+  {
+    auto data = db.lookup( "v1:Cond/group" );
+    ASSERT_EQ( data.index(), 1 );
+    EXPECT_EQ( std::get<1>( data ).iovs->key( 0 ), "../v1" );
+  }
+  {
+    auto data = db.lookup( "v1:Cond/v1" );
+    ASSERT_EQ( data.index(), 0 );
+    EXPECT_EQ( std::get<0>( data ).data(), "data 1" );
+  }
+
+  EXPECT_EQ( db.find_iovs( "v1:Cond" ), db.get_iovs( "v1:Cond/IOVs" ) );
+  EXPECT_FALSE( db.find_iovs( "v1:TheDir" ) );
+  EXPECT_FALSE( db.find_iovs( "v1:Cond/v1" ) );
+  EXPECT_FALSE( db.find_iovs( "v1:Nothing" ) );
+  EXPECT_FALSE( db.find_iovs( "NoTag:Cond" ) );
+
+  try {
+    db.lookup( "v1:Nothing" );
+    FAIL() << "exception expected for invalid path";
+  } catch ( std::runtime_error& err ) {
+    EXPECT_EQ( std::string_view{err.what()}.substr( 0, 32 ), "cannot resolve object v1:Nothing" );
+  }
+}
+
+TEST( GitImpl, RepositoryRegistry ) {
+  auto       registry = GitCondDB::Helpers::git_repository_registry::instance();
+  const auto key      = fs::absolute( "test_data/repo.git" ).string();
+  registry->clear();
+
+  // by default, the handles are closed when released
+  EXPECT_EQ( registry->max_idle(), 0 );
+  {
+    details::GitImpl db{"test_data/repo.git"};
+    EXPECT_TRUE( db.exists( "v1:Cond" ) );
+    db.disconnect();
+    EXPECT_EQ( registry->size( key ), 0 );
+  }
+  EXPECT_EQ( registry->size( key ), 0 );
+
+  registry->set_max_idle( 8 );
+  {
+    details::GitImpl db{"test_data/repo.git"};
+    EXPECT_EQ( registry->size( key ), 0 );
+    EXPECT_TRUE( db.exists( "v1:Cond" ) );
+    // the handle goes back to the registry, with its caches
+    db.disconnect();
+    EXPECT_EQ( registry->size( key ), 1 );
+    EXPECT_TRUE( db.exists( "v1:Cond" ) );
+    EXPECT_EQ( registry->size( key ), 0 );
+  }
+  EXPECT_EQ( registry->size( key ), 1 );
+
+  // a new connection reuses the idle handle
+  {
+    details::GitImpl db{"test_data/repo.git"};
+    EXPECT_EQ( registry->size( key ), 0 );
+    EXPECT_EQ( std::get<0>( db.get( "v1:Cond/v1" ) ), "data 1" );
+  }
+
+  // other repositories do not share the handles
+  {
+    details::GitImpl db{"test_data/repo"};
+    EXPECT_EQ( registry->size( key ), 1 );
+  }
+
+  registry->clear();
+  EXPECT_EQ( registry->size( key ), 0 );
+  {
+    details::GitImpl db{"test_data/repo.git"};
+    EXPECT_TRUE( db.connected() );
+  }
+
+  // disabling the registry closes the idle handles
+  EXPECT_EQ( registry->size( key ), 1 );
+  registry->set_max_idle( 0 );
+  EXPECT_EQ( registry->size( key ), 0 );
+}
+
+TEST( GitImpl, Options ) {
+  // the libgit2 settings are global: keep the current ones to restore them at the end
+  std::size_t mwindow_size = 0, mapped_limit = 0, file_limit = 0;
+  ssize_t     cached_memory = 0, cache_size = 0;
+  git_libgit2_opts( GIT_OPT_GET_MWINDOW_SIZE, &mwindow_size );
+  git_libgit2_opts( GIT_OPT_GET_MWINDOW_MAPPED_LIMIT, &mapped_limit );
+  git_libgit2_opts( GIT_OPT_GET_MWINDOW_FILE_LIMIT, &file_limit );
+  git_libgit2_opts( GIT_OPT_GET_CACHED_MEMORY, &cached_memory, &cache_size );
+
+  {
+    // nothing is changed by default
+    details::GitImpl db{"test_data/repo.git"};
+    std::size_t      value = 0;
+    git_libgit2_opts( GIT_OPT_GET_MWINDOW_SIZE, &value );
+    EXPECT_EQ( value, mwindow_size );
+  }
+
+  GitOptions options;
+  options.object_cache_size       = 64 * 1024 * 1024;
+  options.object_cache_blob_limit = 16 * 1024;
+  options.mwindow_size            = 1024 * 1024;
+  options.mwindow_mapped_limit    = 32 * 1024 * 1024;
+  options.open_packfiles          = 4;
+
+  auto             logger = std::make_shared<CapturingLogger>();
+  details::GitImpl db{"test_data/repo.git", logger, options};
+  EXPECT_EQ( logger->size(), 6 );
+  EXPECT_TRUE( logger->contains( 2, "setting libgit2 option mwindow_size to 1048576" ) );
+  EXPECT_TRUE( logger->contains( 5, "opening Git repository" ) );
+  EXPECT_EQ( std::get<0>( db.get( "v1:Cond/v1" ) ), "data 1" );
+  {
+    std::size_t value = 0;
+    git_libgit2_opts( GIT_OPT_GET_MWINDOW_SIZE, &value );
+    EXPECT_EQ( value, 1024 * 1024 );
+    git_libgit2_opts( GIT_OPT_GET_MWINDOW_MAPPED_LIMIT, &value );
+    EXPECT_EQ( value, 32 * 1024 * 1024 );
+    git_libgit2_opts( GIT_OPT_GET_MWINDOW_FILE_LIMIT, &value );
+    EXPECT_EQ( value, 4 );
+    ssize_t current = 0, allowed = 0;
+    git_libgit2_opts( GIT_OPT_GET_CACHED_MEMORY, &current, &allowed );
+    EXPECT_EQ( allowed, 64 * 1024 * 1024 );
+  }
+
+  // also through connect()
+  EXPECT_EQ( std::get<0>( connect( "test_data/repo.git", options ).get( {"v1", "Cond", 0} ) ), "data 0" );
+  EXPECT_EQ( std::get<0>( connect( "json:{\"Cond\": \"data\"}", options ).get( {"", "Cond", 0} ) ), "data" );
+
+  GitOptions invalid;
+  invalid.object_cache_size = std::numeric_limits<std::size_t>::max();
+  EXPECT_THROW( details::GitImpl( "test_data/repo.git", nullptr, invalid ), std::invalid_argument );
+
+  GitOptions defaults;
+  defaults.object_cache_size       = cache_size;
+  defaults.object_cache_blob_limit = 0;
+  defaults.mwindow_size            = mwindow_size;
+  defaults.mwindow_mapped_limit    = mapped_limit;
+  defaults.open_packfiles          = file_limit;
+  details::GitImpl{"test_data/repo.git", nullptr, defaults};
+}
+
+TEST( GitImpl, PayloadDedup ) {
+  details::GitImpl db{"test_data/repo.git"};
+  EXPECT_EQ( db.dedup_stats().lookups, 0 );
+
+  // same blob in both tags
+  auto p0 = std::get<0>( db.get_payload( "v0:TheDir/TheFile.txt" ) );
+  auto p1 = std::get<0>( db.get_payload( "v1:TheDir/TheFile.txt" ) );
+  EXPECT_EQ( p0.data(), "some data\n" );
+  EXPECT_EQ( p0.data().data(), p1.data().data() );
+  {
+    const auto stats = db.dedup_stats();
+    EXPECT_EQ( stats.lookups, 2 );
+    EXPECT_EQ( stats.hits, 1 );
+    EXPECT_EQ( stats.bytes_saved, 10 );
+    EXPECT_EQ( stats.payloads, 1 );
+    EXPECT_EQ( stats.bytes, 10 );
+  }
+
+  // also through lookup, and not for different blobs
+  auto p2 = std::get<0>( db.lookup( "v1:Cond/v0" ) );
+  auto p3 = std::get<0>( db.lookup( "v0:Cond/v0" ) );
+  auto p4 = std::get<0>( db.lookup( "v1:Cond/v1" ) );
+  EXPECT_EQ( p2.data().data(), p3.data().data() );
+  EXPECT_NE( p2.data().data(), p4.data().data() );
+  EXPECT_EQ( db.dedup_stats().hits, 2 );
+  EXPECT_EQ( db.dedup_stats().payloads, 3 );
+
+  // released payloads are forgotten
+  p0 = p1 = {};
+  EXPECT_EQ( db.dedup_stats().payloads, 2 );
+  EXPECT_EQ( std::get<0>( db.get_payload( "v1:TheDir/TheFile.txt" ) ).data(), "some data\n" );
+  EXPECT_EQ( db.dedup_stats().hits, 2 );
+
+  // payloads can outlive the database
+  {
+    details::GitImpl other{"test_data/repo.git"};
+    p0 = std::get<0>( other.get_payload( "v1:TheDir/TheFile.txt" ) );
+  }
+  EXPECT_EQ( p0.data(), "some data\n" );
+}
+
+TEST( GitImpl, Diff ) {
+  details::GitImpl db{"test_data/repo.git"};
+
+  EXPECT_EQ( db.diff( "v0:", "v1:" ),
+             ( std::vector<std::string>{"Cond/IOVs", "Cond/group/IOVs", "Cond/v2", "Cond/v3"} ) );
+  EXPECT_EQ( db.diff( "v0:Cond/group", "v1:Cond/group" ), std::vector<std::string>{"Cond/group/IOVs"} );
+  EXPECT_TRUE( db.diff( "v0:TheDir", "v1:TheDir" ).empty() );
+  EXPECT_TRUE( db.diff( "v0:Nothing", "v1:Nothing" ).empty() );
+  EXPECT_EQ( db.diff( "v0:Cond/v2", "v1:Cond/v2" ), std::vector<std::string>{"Cond/v2"} );
+  EXPECT_EQ( db.diff( "v1:Cond/v2", "v0:Cond/v2" ), std::vector<std::string>{"Cond/v2"} );
+  EXPECT_EQ( db.diff( "v1:Cond", "v0:Cond" ),
+             ( std::vector<std::string>{"Cond/IOVs", "Cond/group/IOVs", "Cond/v2", "Cond/v3"} ) );
+}
+
 int main( int argc, char** argv ) {
   ::testing::InitGoogleTest( &argc, argv );
   return RUN_ALL_TESTS();
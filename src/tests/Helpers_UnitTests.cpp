@@ -13,11 +13,83 @@
 
 #include "DBImpl.h"
 #include "iov_helpers.h"
+#include "path_helpers.h"
 
 #include "gtest/gtest.h"
 
+#include <random>
+#include <regex>
+#include <sstream>
+
 using namespace GitCondDB::v1;
 
+namespace {
+  // original stream based implementations, used as reference for IOVIndex
+  std::tuple<std::string, CondDB::IOV> reference_get_key_iov( const std::string& data, const CondDB::time_point_t t,
+                                                              const CondDB::IOV& boundaries  = {},
+                                                              const bool         reduce_iovs = true ) {
+    std::tuple<std::string, CondDB::IOV> out;
+    auto&                                key   = std::get<0>( out );
+    auto&                                since = std::get<1>( out ).since;
+    auto&                                until = std::get<1>( out ).until;
+
+    if ( t < boundaries.since || t >= boundaries.until ) {
+      since = until = 0;
+    } else {
+      CondDB::time_point_t current = 0;
+      std::string          line;
+
+      std::istringstream stream{data};
+      std::string        tmp_key;
+
+      while ( std::getline( stream, line ) ) {
+        std::istringstream is{line};
+        is >> current >> tmp_key;
+        if ( !reduce_iovs || tmp_key != key ) {
+          if ( current > t ) {
+            until = current;
+            break;
+          }
+          key   = std::move( tmp_key );
+          since = current;
+        }
+      }
+      std::get<1>( out ).cut( boundaries );
+    }
+    return out;
+  }
+
+  std::vector<std::pair<CondDB::IOV, std::string>> reference_parse_IOVs_keys( const std::string& data ) {
+    std::vector<std::pair<CondDB::IOV, std::string>> out;
+    std::string                                      line;
+
+    CondDB::time_point_t bound;
+    std::string          key;
+
+    std::istringstream stream{data};
+
+    while ( std::getline( stream, line ) ) {
+      std::istringstream is{line};
+      is >> bound >> key;
+      if ( !out.empty() ) { out.back().first.until = bound; }
+      out.emplace_back( CondDB::IOV{bound, CondDB::IOV::max()}, std::move( key ) );
+    }
+
+    return out;
+  }
+
+  // original regex based implementation, used as reference for normalize
+  std::string reference_normalize( std::string path ) {
+    static const std::regex ignored_re{"(/[^/]+/\\.\\./)|(/\\./)"};
+    std::string             old_path;
+    while ( old_path.length() != path.length() ) {
+      old_path.swap( path );
+      path = std::regex_replace( old_path, ignored_re, "/" );
+    }
+    return path;
+  }
+} // namespace
+
 TEST( IOVHelpers, ParseIOVs ) {
   using GitCondDB::Helpers::get_key_iov;
 
@@ -77,6 +149,104 @@ TEST( IOVHelpers, ParseIOVs ) {
   }
 }
 
+TEST( IOVHelpers, IOVIndex ) {
+  using GitCondDB::Helpers::IOVIndex;
+
+  const std::vector<std::string> test_data{"",
+                                           "0 a\n",
+                                           "0 a\n100 b\n200 c\n300 d\n",
+                                           "10 a\n100 b\n200 c\n300 d",
+                                           "0 a\n100 a\n150 b\n200 b\n250 a\n300 c\n",
+                                           "0 a\n100 a\n100 b\n200 a\n",
+                                           "0  a\n 100\tb\r\n200 c extra\n",
+                                           "0 a\n200 b\n100 c\n300 d\n"};
+  const std::vector<CondDB::IOV> boundaries{{}, {0, 100}, {50, 250}, {210, 1000}, {260, 280}};
+
+  for ( const auto& data : test_data ) {
+    const IOVIndex index{data};
+
+    const auto expected = reference_parse_IOVs_keys( data );
+    ASSERT_EQ( index.size(), expected.size() ) << "for data '" << data << "'";
+    for ( std::size_t i = 0; i < index.size(); ++i ) {
+      EXPECT_EQ( index.key( i ), expected[i].second );
+      EXPECT_EQ( index.since( i ), expected[i].first.since );
+      EXPECT_EQ( index.iov( i ).since, expected[i].first.since );
+      EXPECT_EQ( index.iov( i ).until, expected[i].first.until );
+    }
+    const auto parsed = GitCondDB::Helpers::parse_IOVs_keys( data );
+    ASSERT_EQ( parsed.size(), expected.size() );
+    for ( std::size_t i = 0; i < parsed.size(); ++i ) {
+      EXPECT_EQ( parsed[i].second, expected[i].second );
+      EXPECT_EQ( parsed[i].first.since, expected[i].first.since );
+      EXPECT_EQ( parsed[i].first.until, expected[i].first.until );
+    }
+
+    for ( const auto& bounds : boundaries ) {
+      for ( bool reduce : {true, false} ) {
+        for ( CondDB::time_point_t t = 0; t < 400; t += 5 ) {
+          const auto [ref_key, ref_iov] = reference_get_key_iov( data, t, bounds, reduce );
+          const auto [key, iov]         = index.find( t, bounds, reduce );
+          EXPECT_EQ( key, ref_key ) << "for data '" << data << "' at " << t << ( reduce ? " (reduced)" : "" );
+          EXPECT_EQ( iov.since, ref_iov.since ) << "for data '" << data << "' at " << t;
+          EXPECT_EQ( iov.until, ref_iov.until ) << "for data '" << data << "' at " << t;
+        }
+      }
+    }
+  }
+
+  {
+    const IOVIndex index{"0 a\n100 b\n150 b\n200 a\n"};
+    EXPECT_EQ( index.distinct_keys(), 2 );
+    EXPECT_FALSE( index.empty() );
+    EXPECT_TRUE( IOVIndex{}.empty() );
+  }
+}
+
+TEST( PathHelpers, Normalize ) {
+  using GitCondDB::Helpers::normalize;
+
+  EXPECT_EQ( normalize( "" ), "" );
+  EXPECT_EQ( normalize( "a/b/c" ), "a/b/c" );
+  EXPECT_EQ( normalize( "a/./b" ), "a/b" );
+  EXPECT_EQ( normalize( "a/b/../c" ), "a/c" );
+  EXPECT_EQ( normalize( "changing.xml/2017/../2016/v1" ), "changing.xml/2016/v1" );
+  EXPECT_EQ( normalize( "a/b/c/../../d" ), "a/d" );
+  EXPECT_EQ( normalize( "a/b/./../c" ), "a/b/c" );
+
+  // the first segment is never removed, the last one does not remove anything
+  EXPECT_EQ( normalize( "../a" ), "../a" );
+  EXPECT_EQ( normalize( "a/../b" ), "a/../b" );
+  EXPECT_EQ( normalize( "./a" ), "./a" );
+  EXPECT_EQ( normalize( "a/b/.." ), "a/b/.." );
+  EXPECT_EQ( normalize( "a/." ), "a/." );
+  EXPECT_EQ( normalize( "/../a" ), "/../a" );
+  EXPECT_EQ( normalize( "/./a" ), "/a" );
+  EXPECT_EQ( normalize( "a/./" ), "a/" );
+
+  // quirks of the regex based implementation
+  EXPECT_EQ( normalize( "a/b/../../c" ), "a/../c" );
+  EXPECT_EQ( normalize( "a/../../b" ), "a/b" );
+  EXPECT_EQ( normalize( "a//../b" ), "a//../b" );
+  EXPECT_EQ( normalize( "a/.a/./a/../../a/.a" ), "a/.a/a/a/.a" );
+}
+
+TEST( PathHelpers, NormalizeReference ) {
+  using GitCondDB::Helpers::normalize;
+
+  const std::vector<std::string> segments{"a", "bb", ".", "..", "", "...", ".a"};
+
+  std::mt19937                               gen{12345};
+  std::uniform_int_distribution<std::size_t> segment( 0, segments.size() - 1 ), length( 1, 10 );
+  for ( int i = 0; i < 20000; ++i ) {
+    std::string path = segments[segment( gen )];
+    for ( auto n = length( gen ); n > 1; --n ) {
+      path += '/';
+      path += segments[segment( gen )];
+    }
+    ASSERT_EQ( normalize( path ), reference_normalize( path ) ) << "path: " << path;
+  }
+}
+
 using IOV = CondDB::IOV;
 
 TEST( IOV, Validity ) {
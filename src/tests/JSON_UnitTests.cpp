@@ -105,6 +105,10 @@ TEST( JSONImpl, AccessMemory ) {
     EXPECT_TRUE( db.exists( "HEAD:TheDir" ) );
     EXPECT_TRUE( db.exists( "HEAD:TheDir/TheFile.txt" ) );
     EXPECT_FALSE( db.exists( "HEAD:NoFile" ) );
+    EXPECT_TRUE( db.exists( "HEAD:Cond/IOVs" ) );
+    EXPECT_TRUE( db.exists( "HEAD:" ) );
+    EXPECT_FALSE( db.exists( "HEAD:TheDir/" ) );
+    EXPECT_FALSE( db.exists( "HEAD:TheDir/TheFile.txt/more" ) );
   }
 
   try {
@@ -130,6 +134,53 @@ TEST( JSONImpl, AccessMemory ) {
   EXPECT_EQ( db.commit_time( "HEAD" ), std::chrono::time_point<std::chrono::system_clock>::max() );
 }
 
+TEST( JSONTree, Parse ) {
+  const auto tree = details::JSONTree::parse( R"({
+    "b": {"x": "1", "y": {"z": "2"}},
+    "a": "3",
+    "list": ["4", {"w": "5"}, [6]],
+    "number": 7,
+    "nothing": null,
+    "dup": "8",
+    "dup": "9"
+  })" );
+  using node_type = details::JSONTree::node_type;
+
+  const auto root = tree->find( "" );
+  ASSERT_TRUE( root );
+  EXPECT_EQ( root->type, node_type::object );
+  std::vector<std::string_view> keys;
+  tree->for_each_child( *root, [&]( const auto& child ) { keys.push_back( tree->key( child ) ); } );
+  EXPECT_EQ( keys, ( std::vector<std::string_view>{"a", "b", "dup", "list", "number"} ) );
+
+  ASSERT_TRUE( tree->find( "b/y/z" ) );
+  EXPECT_EQ( tree->value( *tree->find( "b/y/z" ) ), "2" );
+  EXPECT_EQ( tree->key( *tree->find( "b/y/z" ) ), "z" );
+  EXPECT_EQ( tree->value( *tree->find( "a" ) ), "3" );
+  EXPECT_EQ( tree->value( *tree->find( "dup" ) ), "9" );
+  // the content of entries replaced by duplicated keys is not reachable
+  const auto replaced = details::JSONTree::parse( R"({"a": {"b": "1"}, "a": {"c": "2"}, "d": {"a": {"b": "3"}}})" );
+  EXPECT_FALSE( replaced->find( "a/b" ) );
+  EXPECT_EQ( replaced->value( *replaced->find( "a/c" ) ), "2" );
+  EXPECT_EQ( replaced->value( *replaced->find( "d/a/b" ) ), "3" );
+  EXPECT_EQ( tree->find( "b/y" )->type, node_type::object );
+
+  // only strings and objects are interesting, and the content of arrays is ignored
+  EXPECT_EQ( tree->find( "number" )->type, node_type::other );
+  EXPECT_EQ( tree->find( "list" )->type, node_type::other );
+  EXPECT_FALSE( tree->find( "list/w" ) );
+  EXPECT_FALSE( tree->find( "nothing" ) );
+  EXPECT_FALSE( tree->find( "b/" ) );
+  EXPECT_FALSE( tree->find( "/b" ) );
+
+  try {
+    details::JSONTree::parse( R"({"a": "b",})" );
+    FAIL() << "exception expected for invalid JSON";
+  } catch ( std::runtime_error& err ) {
+    EXPECT_EQ( std::string_view{err.what()}.substr( 0, 14 ), "invalid JSON: " );
+  }
+}
+
 int main( int argc, char** argv ) {
   ::testing::InitGoogleTest( &argc, argv );
   return RUN_ALL_TESTS();
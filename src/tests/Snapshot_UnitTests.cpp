@@ -0,0 +1,283 @@
+/*****************************************************************************\
+* (c) Copyright 2018 CERN for the benefit of the LHCb Collaboration           *
+*                                                                             *
+* This software is distributed under the terms of the Apache version 2        *
+* licence, copied verbatim in the file "COPYING".                             *
+*                                                                             *
+* In applying this licence, CERN does not waive the privileges and immunities *
+* granted to it by virtue of its status as an Intergovernmental Organization  *
+* or submit itself to any jurisdiction.                                       *
+\*****************************************************************************/
+
+#include "GitCondDB.h"
+
+#include "DBImpl.h"
+#include "iov_helpers.h"
+
+#include "test_common.h"
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <fstream>
+
+using namespace GitCondDB::v1;
+
+namespace {
+  /// Create a snapshot of a tag of a repository, returning its path.
+  std::string make_snapshot( const std::string& repository, const std::string& tag, const std::string& name ) {
+    const std::string path = "test_data/" + name + ".snapshot";
+    connect( repository ).export_snapshot( tag, path );
+    return path;
+  }
+
+  std::vector<CondDB::time_point_t> time_points( CondDB::time_point_t max, CondDB::time_point_t step ) {
+    std::vector<CondDB::time_point_t> out;
+    for ( CondDB::time_point_t t = 0; t < max; t += step ) out.push_back( t );
+    return out;
+  }
+
+  /// Result of CondDB::get, with an empty IOV in case of error.
+  std::tuple<std::string, CondDB::IOV> get_or_error( const CondDB& db, const CondDB::Key& key,
+                                                     const CondDB::IOV& bounds ) {
+    try {
+      return db.get( key, bounds );
+    } catch ( std::runtime_error& ) { return {"error", {0, 0}}; }
+  }
+} // namespace
+
+TEST( SnapshotImpl, Connection ) {
+  const auto path = make_snapshot( "test_data/repo.git", "v1", "connection" );
+
+  auto                  logger = std::make_shared<CapturingLogger>();
+  details::SnapshotImpl db{path, logger};
+  EXPECT_EQ( logger->size(), 1 );
+  EXPECT_TRUE( logger->contains( "using snapshot file " ) );
+
+  EXPECT_EQ( db.backend_name(), "snapshot" );
+  EXPECT_EQ( db.tag(), "v1" );
+  EXPECT_TRUE( db.connected() );
+  db.disconnect();
+  EXPECT_TRUE( db.connected() );
+
+  EXPECT_TRUE( db.exists( "v1" ) );
+  EXPECT_FALSE( db.exists( "v0" ) );
+  EXPECT_FALSE( db.exists( "v0:TheDir" ) );
+
+  EXPECT_EQ( db.commit_time( "v1" ), std::chrono::system_clock::from_time_t( 1483225200 ) );
+  try {
+    db.commit_time( "v0" );
+    FAIL() << "exception expected for invalid commit";
+  } catch ( std::runtime_error& err ) {
+    EXPECT_EQ( std::string_view{err.what()}, "cannot resolve commit v0: not in snapshot" );
+  }
+
+  // snapshots of directories do not have a commit time
+  details::SnapshotImpl fs_db{make_snapshot( "file:test_data/repo", "HEAD", "connection_fs" )};
+  EXPECT_EQ( fs_db.commit_time( "HEAD" ), std::chrono::time_point<std::chrono::system_clock>::max() );
+}
+
+TEST( SnapshotImpl, FailAccess ) {
+  try {
+    details::SnapshotImpl{"test_data/no-file.snapshot"};
+    FAIL() << "exception expected for missing file";
+  } catch ( std::runtime_error& err ) {
+    EXPECT_EQ( std::string_view{err.what()}, "cannot open file test_data/no-file.snapshot" );
+  }
+
+  {
+    std::ofstream{"test_data/empty.snapshot"};
+  }
+  try {
+    details::SnapshotImpl{"test_data/empty.snapshot"};
+    FAIL() << "exception expected for empty file";
+  } catch ( std::runtime_error& err ) {
+    EXPECT_EQ( std::string_view{err.what()}, "invalid snapshot file test_data/empty.snapshot: too short" );
+  }
+
+  {
+    std::ofstream out{"test_data/not-a.snapshot"};
+    out << std::string( 200, 'x' );
+  }
+  try {
+    details::SnapshotImpl{"test_data/not-a.snapshot"};
+    FAIL() << "exception expected for invalid file";
+  } catch ( std::runtime_error& err ) {
+    EXPECT_EQ( std::string_view{err.what()}, "invalid snapshot file test_data/not-a.snapshot: wrong signature" );
+  }
+
+  try {
+    connect( "test_data/repo.git" ).export_snapshot( "no-tag", "test_data/no-tag.snapshot" );
+    FAIL() << "exception expected for invalid tag";
+  } catch ( std::runtime_error& err ) {
+    EXPECT_EQ( std::string_view{err.what()}.substr( 0, 29 ), "cannot resolve object no-tag:" );
+  }
+  EXPECT_FALSE( fs::exists( "test_data/no-tag.snapshot" ) );
+}
+
+TEST( SnapshotImpl, Access ) {
+  details::SnapshotImpl db{make_snapshot( "test_data/repo.git", "v1", "access" )};
+
+  EXPECT_TRUE( db.exists( "v1:TheDir/TheFile.txt" ) );
+  EXPECT_TRUE( db.exists( "v1:Cond/group/IOVs" ) );
+  EXPECT_TRUE( db.exists( "v1:" ) );
+  EXPECT_FALSE( db.exists( "v1:Nothing" ) );
+  EXPECT_FALSE( db.exists( "v1:TheDir/TheFile.txt/more" ) );
+  EXPECT_FALSE( db.exists( "v1:TheDir//TheFile.txt" ) );
+
+  EXPECT_EQ( std::get<0>( db.get( "v1:TheDir/TheFile.txt" ) ), "some data\n" );
+  EXPECT_EQ( std::get<0>( db.get( "v1:Cond/v2" ) ), "data 2" );
+
+  {
+    const auto cont = std::get<1>( db.get( "v1:Cond" ) );
+    EXPECT_EQ( cont.root, "Cond" );
+    EXPECT_EQ( cont.dirs, std::vector<std::string>{"group"} );
+    EXPECT_EQ( cont.files, ( std::vector<std::string>{"IOVs", "v0", "v1", "v2", "v3"} ) );
+  }
+  {
+    const auto cont = std::get<1>( db.get( "v1:" ) );
+    EXPECT_EQ( cont.root, "" );
+    EXPECT_EQ( cont.dirs, ( std::vector<std::string>{"Cond", "TheDir"} ) );
+    EXPECT_TRUE( cont.files.empty() );
+  }
+
+  try {
+    db.get( "v1:Nothing" );
+    FAIL() << "exception expected for invalid path";
+  } catch ( std::runtime_error& err ) {
+    EXPECT_EQ( std::string_view{err.what()}, "cannot resolve object v1:Nothing" );
+  }
+
+  {
+    // directories with IOVs are conditions
+    const auto data = db.lookup( "v1:" );
+    ASSERT_EQ( data.index(), 1 );
+    const auto& dir = std::get<1>( data );
+    EXPECT_FALSE( dir.iovs );
+    EXPECT_EQ( dir.content.dirs, std::vector<std::string>{"TheDir"} );
+    EXPECT_EQ( dir.content.files, std::vector<std::string>{"Cond"} );
+  }
+  {
+    const auto data = db.lookup( "v1:Cond" );
+    ASSERT_EQ( data.index(), 1 );
+    const auto& dir = std::get<1>( data );
+    ASSERT_TRUE( dir.iovs );
+    EXPECT_EQ( dir.iovs->size(), 3 );
+    EXPECT_EQ( dir.iovs->key( 1 ), "group" );
+    EXPECT_EQ( std::get<0>( dir.iovs->find( 150 ) ), "group" );
+    // the same index is returned for the same file
+    EXPECT_EQ( db.find_iovs( "v1:Cond" ), dir.iovs );
+    EXPECT_EQ( db.get_iovs( "v1:Cond/IOVs" ), dir.iovs );
+  }
+  EXPECT_FALSE( db.find_iovs( "v1:TheDir" ) );
+  EXPECT_FALSE( db.find_iovs( "v1:Cond/v0" ) );
+  EXPECT_FALSE( db.find_iovs( "v1:Nothing" ) );
+
+  {
+    // payloads are views on the snapshot file, and identical payloads are stored once
+    const auto a = std::get<0>( db.get_payload( "v1:Cond/group/IOVs" ) );
+    const auto b = std::get<0>( db.get_payload( "v1:Cond/group/IOVs" ) );
+    EXPECT_EQ( a.data().data(), b.data().data() );
+    EXPECT_EQ( a.str(), "50 ../v1\n150 ../v2\n" );
+  }
+}
+
+TEST( Snapshot, SameAsSource ) {
+  const std::vector<std::tuple<std::string, std::string, std::vector<std::string>>> sources{
+      {"test_data/repo.git", "v0", {"Cond", "Cond/group", "Cond/v0", "TheDir", "TheDir/TheFile.txt", ""}},
+      {"test_data/repo.git", "v1", {"Cond", "Cond/group", "Cond/v2", "TheDir", "TheDir/TheFile.txt", "Cond/./v1"}},
+      {"file:test_data/repo", "HEAD", {"Cond", "Cond/group", "TheDir", "TheDir/TheFile.txt"}},
+      {"json:test_data/json/repo.json", "HEAD", {"Cond", "Cond/group", "TheDir", "TheDir/TheFile.txt"}},
+      {"test_data/lhcb/repo",
+       "v1",
+       {"values.xml", "changing.xml", "Direct", "Direct/Cond1", "Direct/Nested", "DTD/structure.dtd", ""}}};
+
+  int counter = 0;
+  for ( const auto& [repository, tag, paths] : sources ) {
+    const CondDB source   = connect( repository );
+    const auto   snapshot = make_snapshot( repository, tag, "same_" + std::to_string( ++counter ) );
+    const CondDB db       = connect( "snapshot:" + snapshot );
+
+    for ( const auto t : time_points( 1500000000000000000, 100000000000000000 ) ) {
+      for ( const auto& path : paths ) {
+        for ( const CondDB::IOV& bounds : {CondDB::IOV{}, CondDB::IOV{50, 1483228800000000000}} ) {
+          const auto [data, iov]              = get_or_error( db, {tag, path, t}, bounds );
+          const auto [expected, expected_iov] = get_or_error( source, {tag, path, t}, bounds );
+          EXPECT_EQ( data, expected ) << repository << " " << tag << ":" << path << " at " << t;
+          EXPECT_EQ( iov.since, expected_iov.since ) << repository << " " << tag << ":" << path << " at " << t;
+          EXPECT_EQ( iov.until, expected_iov.until ) << repository << " " << tag << ":" << path << " at " << t;
+        }
+      }
+    }
+    if ( std::find( begin( paths ), end( paths ), "Cond" ) == end( paths ) ) continue;
+    for ( const auto t : time_points( 300, 10 ) ) {
+      const auto [data, iov]              = get_or_error( db, {tag, "Cond", t}, {} );
+      const auto [expected, expected_iov] = get_or_error( source, {tag, "Cond", t}, {} );
+      EXPECT_EQ( data, expected ) << repository << " " << tag << ":Cond at " << t;
+      EXPECT_EQ( iov.since, expected_iov.since );
+      EXPECT_EQ( iov.until, expected_iov.until );
+    }
+    for ( const auto& path : paths ) {
+      EXPECT_EQ( db.iov_boundaries( tag, path ), source.iov_boundaries( tag, path ) ) << repository << " " << path;
+    }
+  }
+}
+
+TEST( Snapshot, Range ) {
+  const CondDB source = connect( "test_data/repo.git" );
+  source.export_snapshot( "v1", "test_data/range.snapshot", {100, 200} );
+
+  details::SnapshotImpl db{"test_data/range.snapshot"};
+  EXPECT_EQ( db.range().since, 100 );
+  EXPECT_EQ( db.range().until, 200 );
+
+  // only the conditions valid in the range are kept
+  EXPECT_TRUE( db.exists( "v1:TheDir/TheFile.txt" ) );
+  EXPECT_TRUE( db.exists( "v1:Cond/group/IOVs" ) );
+  EXPECT_FALSE( db.exists( "v1:Cond/v0" ) );
+  EXPECT_TRUE( db.exists( "v1:Cond/v1" ) );
+  EXPECT_TRUE( db.exists( "v1:Cond/v2" ) );
+  EXPECT_FALSE( db.exists( "v1:Cond/v3" ) );
+  // and the IOVs files are trimmed (keeping the first entry after the range, for the end of validity)
+  EXPECT_EQ( std::get<0>( db.get( "v1:Cond/IOVs" ) ), "100 group\n200 v3\n" );
+  EXPECT_EQ( std::get<0>( db.get( "v1:Cond/group/IOVs" ) ), "50 ../v1\n150 ../v2\n" );
+
+  source.export_snapshot( "v1", "test_data/range.snapshot", {160, 170} );
+  details::SnapshotImpl narrow{"test_data/range.snapshot"};
+  EXPECT_EQ( std::get<0>( narrow.get( "v1:Cond/IOVs" ) ), "100 group\n200 v3\n" );
+  EXPECT_EQ( std::get<0>( narrow.get( "v1:Cond/group/IOVs" ) ), "150 ../v2\n" );
+  EXPECT_FALSE( narrow.exists( "v1:Cond/v1" ) );
+  EXPECT_FALSE( narrow.exists( "v1:Cond/v0" ) );
+
+  const std::vector<std::tuple<std::string, std::string, CondDB::IOV, std::vector<std::string>>> sources{
+      {"test_data/repo.git", "v1", {100, 200}, {"Cond", "Cond/group", "TheDir/TheFile.txt"}},
+      {"test_data/repo.git", "v1", {160, 170}, {"Cond", "Cond/group", "TheDir/TheFile.txt"}},
+      {"test_data/lhcb/repo",
+       "v1",
+       {1451606400000000000, 1483228800000000000},
+       {"values.xml", "changing.xml", "Direct/Cond1", "DTD/structure.dtd"}}};
+
+  int counter = 0;
+  for ( const auto& [repository, tag, range, paths] : sources ) {
+    const CondDB full = connect( repository );
+    const auto   path = "test_data/range_" + std::to_string( ++counter ) + ".snapshot";
+    full.export_snapshot( tag, path, range );
+    const CondDB db = connect( "snapshot:" + path );
+
+    const auto step = std::max<CondDB::time_point_t>( ( range.until - range.since ) / 20, 1 );
+    for ( auto t = range.since; t < range.until; t += step ) {
+      for ( const auto& p : paths ) {
+        for ( const CondDB::IOV& bounds : {CondDB::IOV{}, range} ) {
+          const auto [data, iov]              = get_or_error( db, {tag, p, t}, bounds );
+          const auto [expected, expected_iov] = get_or_error( full, {tag, p, t}, bounds );
+          EXPECT_EQ( data, expected ) << repository << " " << tag << ":" << p << " at " << t;
+          EXPECT_EQ( iov.since, expected_iov.since ) << repository << " " << tag << ":" << p << " at " << t;
+          EXPECT_EQ( iov.until, expected_iov.until ) << repository << " " << tag << ":" << p << " at " << t;
+        }
+      }
+    }
+    for ( const auto& p : paths ) {
+      EXPECT_EQ( db.iov_boundaries( tag, p, range ), full.iov_boundaries( tag, p, range ) ) << repository << " " << p;
+    }
+  }
+}
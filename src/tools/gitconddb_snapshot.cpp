@@ -0,0 +1,40 @@
+/*****************************************************************************\
+* (c) Copyright 2018 CERN for the benefit of the LHCb Collaboration           *
+*                                                                             *
+* This software is distributed under the terms of the Apache version 2        *
+* licence, copied verbatim in the file "COPYING".                             *
+*                                                                             *
+* In applying this licence, CERN does not waive the privileges and immunities *
+* granted to it by virtue of its status as an Intergovernmental Organization  *
+* or submit itself to any jurisdiction.                                       *
+\*****************************************************************************/
+
+#include <GitCondDB.h>
+
+#include <exception>
+#include <iostream>
+#include <string>
+
+using namespace GitCondDB::v1;
+
+/// Compile a tag of a conditions database into a snapshot file, to be used with
+/// connect( "snapshot:<output>" ).
+int main( int argc, char* argv[] ) {
+  if ( argc != 4 && argc != 6 ) {
+    std::cerr << "usage: " << argv[0] << " REPOSITORY TAG OUTPUT [SINCE UNTIL]\n\n"
+              << "Write the content of TAG in REPOSITORY (any string accepted by GitCondDB::connect)\n"
+              << "to the snapshot file OUTPUT.\n"
+              << "If SINCE and UNTIL are given, only the conditions valid in [SINCE, UNTIL) are written.\n";
+    return 2;
+  }
+  try {
+    const CondDB db = connect( argv[1] );
+    CondDB::IOV  range;
+    if ( argc == 6 ) range = {std::stoull( argv[4] ), std::stoull( argv[5] )};
+    db.export_snapshot( argv[2], argv[3], range );
+  } catch ( const std::exception& err ) {
+    std::cerr << "error: " << err.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
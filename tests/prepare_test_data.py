@@ -13,6 +13,9 @@
 from __future__ import print_function
 '''
 Script to prepare test data files and directories.
+
+With the option --benchmark, prepare instead the (large) synthetic repository
+used by the benchmarks.
 '''
 
 import sys
@@ -33,6 +36,7 @@ def call(*args, **kwargs):
         out = check_output(*args, **kwargs).rstrip()
         if out:
             logging.debug('OUTPUT:\n%s', out)
+        return out.decode()
     except CalledProcessError as err:
         logging.error('%s failed with exit code %s', err.cmd, err.returncode)
         if err.output:
@@ -112,6 +116,18 @@ def lhcb_conddb_case(path):
     call(['git', 'commit', '-am', 'v1 data'], cwd=path)
     call(['git', 'tag', 'v1'], cwd=path)
 
+    # same content as v1 with an unused file in a condition (tag not on the branch)
+    unused = join('changing.xml', '2017', 'unused')
+    write_file(join(path, unused), 'not referenced\n')
+    call(['git', 'add', unused], cwd=path)
+    tree = call(['git', 'write-tree'], cwd=path)
+    commit = call(['git', 'commit-tree', tree, '-p', 'v1', '-m', 'unused file'],
+                  cwd=path,
+                  env=env)
+    call(['git', 'tag', 'v1-unused', commit], cwd=path)
+    call(['git', 'rm', '--cached', '--quiet', unused], cwd=path)
+    os.remove(join(path, unused))
+
     # changes for HEAD version (no tag)
     with open(join(src_data, 'values.xml')) as in_file:
         with open(join(path, 'values.xml'), 'w') as out_file:
@@ -201,6 +217,166 @@ def write_json_files(path):
         dump({}, f)
     with open(join(path, 'basic.json'), 'w') as f:
         dump({"TheDir": {"TheFile.txt": "some JSON (file) data\n"}}, f)
+    # same content as the test repository (tag v1)
+    with open(join(path, 'repo.json'), 'w') as f:
+        dump(
+            {
+                "TheDir": {
+                    "TheFile.txt": "some data\n"
+                },
+                "Cond": {
+                    "IOVs": "0 v0\n100 group\n200 v3\n",
+                    "group": {
+                        "IOVs": "50 ../v1\n150 ../v2\n"
+                    },
+                    "v0": "data 0",
+                    "v1": "data 1",
+                    "v2": "data 2",
+                    "v3": "data 3"
+                }
+            }, f)
+
+
+# size of the benchmark repository (keep in sync with src/benchmarks)
+BENCH_SYSTEMS = 20
+BENCH_CONDITIONS = 100  # per system
+BENCH_DEEP_LEVELS = 16
+BENCH_LARGE_IOVS = 100000
+BENCH_LARGE_PAYLOADS = 100
+BENCH_BIG_BLOBS = {'1MiB': 1 << 20, '16MiB': 16 << 20}
+
+
+def write_file(path, data):
+    with open(path, 'w') as f:
+        f.write(data)
+
+
+def random_text(rng, size):
+    '''
+    Return a printable string of the requested size.
+    '''
+    line = ''.join(
+        rng.choice('abcdefghijklmnopqrstuvwxyz0123456789 ')
+        for _ in range(79)) + '\n'
+    return (line * (size // len(line) + 1))[:size]
+
+
+def condition_payload(name, version):
+    return ('<?xml version="1.0" encoding="UTF-8"?>\n'
+            '<DDDB><condition name="{0}">\n'
+            '<param name="version" type="int">{1}</param>\n'
+            '<paramVector name="values" type="double">{2}</paramVector>\n'
+            '</condition></DDDB>\n').format(
+                name, version,
+                ' '.join(str(version * 0.5 + i) for i in range(16)))
+
+
+def dir_to_dict(path):
+    '''
+    Return the content of a directory as a dictionary suitable for the JSON backend.
+    '''
+    out = {}
+    for name in os.listdir(path):
+        if name == '.git':
+            continue
+        full = join(path, name)
+        if isdir(full):
+            out[name] = dir_to_dict(full)
+        else:
+            with open(full) as f:
+                out[name] = f.read()
+    return out
+
+
+def create_benchmark_repo(path):
+    '''
+    Create a large repository for the benchmarks, with:
+    - many conditions with a few IOVs (Conditions/SysXX/CondYYY.xml)
+    - a deep chain of partitions pointing to the previous ones (Deep.xml)
+    - a condition with a large IOVs file (Large.xml)
+    - big payloads (Big/...)
+
+    The same data is written to a JSON file, for the JSON backend, and a packed
+    bare clone of the repository is created (for the tuning of pack file access).
+    '''
+    from random import Random
+    from json import dump
+    rng = Random(12345)
+
+    if exists(path):
+        rmtree(path)
+    call(['git', 'init', path])
+    call(['git', 'config', '-f', '.git/config', 'user.name', 'Test User'],
+         cwd=path)
+    call([
+        'git', 'config', '-f', '.git/config', 'user.email',
+        'test.user@no.where'
+    ],
+         cwd=path)
+
+    boundaries = [EPOCH, datetime(2016, 1, 1), datetime(2017, 1, 1)]
+    for i in range(BENCH_SYSTEMS):
+        for j in range(BENCH_CONDITIONS):
+            cond = join(path, 'Conditions', 'Sys{0:02}'.format(i),
+                        'Cond{0:03}.xml'.format(j))
+            makedirs(cond)
+            write_IOVs([(dt, 'v{0}'.format(n))
+                        for n, dt in enumerate(boundaries)], cond)
+            for n in range(len(boundaries)):
+                write_file(
+                    join(cond, 'v{0}'.format(n)),
+                    condition_payload('Cond{0:03}'.format(j), n))
+
+    # Deep.xml/IOVs -> Deep.xml/N/IOVs -> Deep.xml/N-1/IOVs -> ... -> v0
+    deep = join(path, 'Deep.xml')
+    makedirs(deep)
+    write_IOVs([(EPOCH, str(BENCH_DEEP_LEVELS))], deep)
+    for level in range(BENCH_DEEP_LEVELS + 1):
+        level_dir = join(deep, str(level))
+        makedirs(level_dir)
+        payload = 'v{0}'.format(level)
+        write_file(join(level_dir, payload), condition_payload('Deep', level))
+        iovs = [(EPOCH, '../{0}'.format(level - 1))] if level else []
+        iovs.append((datetime(2000 + level, 1, 1) if level else EPOCH,
+                     payload))
+        write_IOVs(iovs, level_dir)
+
+    large = join(path, 'Large.xml')
+    makedirs(large)
+    for n in range(BENCH_LARGE_PAYLOADS):
+        write_file(join(large, 'p{0}'.format(n)), condition_payload('Large', n))
+    with open(join(large, 'IOVs'), 'w') as IOVs:
+        IOVs.write(''.join('{0} p{1}\n'.format(n * 1000, n % BENCH_LARGE_PAYLOADS)
+                           for n in range(BENCH_LARGE_IOVS)))
+
+    makedirs(join(path, 'Big'))
+    for name, size in BENCH_BIG_BLOBS.items():
+        write_file(join(path, 'Big', name), random_text(rng, size))
+
+    call(['git', 'add', '.'], cwd=path)
+    env = dict(os.environ)
+    env['GIT_COMMITTER_DATE'] = env['GIT_AUTHOR_DATE'] = '1483225100'
+    call(['git', 'commit', '-m', 'initial version'], cwd=path, env=env)
+    call(['git', 'tag', 'v0'], cwd=path, env=env)
+
+    # change some of the conditions
+    for i in range(0, BENCH_SYSTEMS, 2):
+        for j in range(0, BENCH_CONDITIONS, 10):
+            cond = join(path, 'Conditions', 'Sys{0:02}'.format(i),
+                        'Cond{0:03}.xml'.format(j))
+            write_file(join(cond, 'v2'), condition_payload('changed', 2))
+    call(['git', 'add', '.'], cwd=path)
+    env['GIT_COMMITTER_DATE'] = env['GIT_AUTHOR_DATE'] = '1483225200'
+    call(['git', 'commit', '-m', 'new version'], cwd=path, env=env)
+    call(['git', 'tag', 'v1'], cwd=path, env=env)
+
+    with open(path + '.json', 'w') as f:
+        dump(dir_to_dict(path), f)
+
+    packed = path + '-packed.git'
+    if exists(packed):
+        rmtree(packed)
+    call(['git', 'clone', '--quiet', '--bare', '--no-local', path, packed])
 
 
 def main():
@@ -209,6 +385,10 @@ def main():
               or os.environ.get('VERBOSE')) else logging.WARNING)
     logging.basicConfig(level=level)
 
+    if '--benchmark' in sys.argv:
+        create_benchmark_repo(join('bench_data', 'repo'))
+        return
+
     if exists('test_data'):
         logging.debug('removing existing test_data')
         rmtree('test_data')